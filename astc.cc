@@ -4,7 +4,14 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "memory.h"
+#include "parallel.h"
 
 // Enums copied from GL/GL.h
 #define GL_RED 0x1903
@@ -102,6 +109,7 @@ void GetBitnessFromGlType(uint32_t gl_type, int& bitness,
     case GL_UNSIGNED_BYTE: {
       bitness = 8;
       bytes_per_component = 1;
+      break;
     }
     case GL_UNSIGNED_SHORT: {
       bitness = 16;
@@ -763,6 +771,8 @@ struct encode_astc_image_info {
   int* threads_completed;
   const astc_codec_image* input_image;
   astc_codec_image* output_image;
+  // Blocks with a zero entry are skipped. NULL encodes every block.
+  const uint8_t* block_mask;
 };
 
 void* encode_astc_image_threadfunc(void* vblk) {
@@ -782,6 +792,7 @@ void* encode_astc_image_threadfunc(void* vblk) {
   int* threads_completed = blk->threads_completed;
   const astc_codec_image* input_image = blk->input_image;
   astc_codec_image* output_image = blk->output_image;
+  const uint8_t* block_mask = blk->block_mask;
 
   imageblock pb;
   int ctr = thread_id;
@@ -822,7 +833,12 @@ void* encode_astc_image_threadfunc(void* vblk) {
     for (y = 0; y < yblocks; y++)
       for (x = 0; x < xblocks; x++) {
         if (ctr == 0) {
-          int offset = ((z * yblocks + y) * xblocks + x) * 16;
+          const int block_index = (z * yblocks + y) * xblocks + x;
+          if (block_mask && !block_mask[block_index]) {
+            ctr = threadcount - 1;
+            continue;
+          }
+          int offset = block_index * 16;
           uint8_t* bp = buffer + offset;
 #ifdef DEBUG_PRINT_DIAGNOSTICS
           if (diagnostics_tile < 0 || diagnostics_tile == pctr) {
@@ -904,7 +920,8 @@ void encode_astc_image(const astc_codec_image* input_image,
                        int zdim, const error_weighting_params* ewp,
                        astc_decode_mode decode_mode, swizzlepattern swz_encode,
                        swizzlepattern swz_decode, uint8_t* buffer,
-                       int pack_and_unpack, int threadcount) {
+                       int pack_and_unpack, int threadcount,
+                       const uint8_t* block_mask) {
   int i;
   int* counters = new int[threadcount];
   int* threads_completed = new int[threadcount];
@@ -931,6 +948,7 @@ void encode_astc_image(const astc_codec_image* input_image,
     ai[i].threads_completed = threads_completed;
     ai[i].input_image = input_image;
     ai[i].output_image = output_image;
+    ai[i].block_mask = block_mask;
     counters[i] = 0;
     threads_completed[i] = 0;
   }
@@ -952,10 +970,109 @@ void encode_astc_image(const astc_codec_image* input_image,
   delete[] threads_completed;
 }
 
+AstcBlockCache::AstcBlockCache(size_t max_entries)
+    : max_entries_(max_entries) {}
+
+bool AstcBlockCache::Find(const std::string& key, uint8_t* block) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = blocks_.find(key);
+  if (it == blocks_.end()) {
+    return false;
+  }
+  memcpy(block, it->second.data, sizeof(it->second.data));
+  return true;
+}
+
+void AstcBlockCache::Insert(const std::string& key, const uint8_t* block) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (blocks_.size() >= max_entries_) {
+    blocks_.clear();
+  }
+  memcpy(blocks_[key].data, block, sizeof(Block::data));
+}
+
+void AstcBlockCache::AddStats(uint64_t hits, uint64_t misses) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.hits += hits;
+  stats_.misses += misses;
+}
+
+AstcBlockCache::Stats AstcBlockCache::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+// Where each block of an image gets its encoding from.
+struct BlockDedupe {
+  std::vector<std::string> keys;
+  // -1 for blocks found in the cache, the block's own index for blocks that
+  // are encoded and the index of an identical earlier block otherwise.
+  std::vector<int> sources;
+};
+
+// Looks up every block of |input_image| in |cache| and in the blocks before
+// it. Cache hits are copied to |buffer| and only the first of each set of
+// identical blocks stays set in |block_mask|. The encoded result only depends
+// on the block texels since the error weighting uses no neighborhood, so
+// |settings| must name everything else that changes the encoding.
+void PrepareBlockDedupe(const astc_codec_image* input_image, int xdim,
+                        int ydim, astc_decode_mode decode_mode,
+                        const std::string& settings, swizzlepattern swz,
+                        AstcBlockCache* cache, uint8_t* buffer,
+                        uint8_t* block_mask, BlockDedupe* dedupe) {
+  const int xblocks = (input_image->xsize + xdim - 1) / xdim;
+  const int yblocks = (input_image->ysize + ydim - 1) / ydim;
+  const int num_blocks = xblocks * yblocks;
+  const std::string prefix = std::to_string(xdim) + "x" +
+                             std::to_string(ydim) + "," +
+                             std::to_string(decode_mode) + "," + settings + ":";
+  const size_t texel_bytes = xdim * ydim * 4 * sizeof(float);
+
+  dedupe->keys.resize(num_blocks);
+  dedupe->sources.resize(num_blocks);
+  std::unordered_map<std::string, int> first_blocks;
+  uint64_t hits = 0;
+  imageblock pb;
+  for (int i = 0; i < num_blocks; ++i) {
+    fetch_imageblock(input_image, &pb, xdim, ydim, 1, (i % xblocks) * xdim,
+                     (i / xblocks) * ydim, 0, swz);
+    std::string& key = dedupe->keys[i];
+    key = prefix;
+    key.append(reinterpret_cast<const char*>(pb.orig_data), texel_bytes);
+
+    if (cache->Find(key, buffer + i * 16)) {
+      dedupe->sources[i] = -1;
+      block_mask[i] = 0;
+      ++hits;
+      continue;
+    }
+    auto inserted = first_blocks.insert(std::make_pair(key, i));
+    dedupe->sources[i] = inserted.first->second;
+    block_mask[i] = inserted.second;
+    hits += !inserted.second;
+  }
+  cache->AddStats(hits, num_blocks - hits);
+}
+
+// Copies the encoded blocks to their duplicates and adds them to |cache|.
+void FinishBlockDedupe(const BlockDedupe& dedupe, AstcBlockCache* cache,
+                       uint8_t* buffer) {
+  for (size_t i = 0; i < dedupe.sources.size(); ++i) {
+    const int source = dedupe.sources[i];
+    if (source == static_cast<int>(i)) {
+      cache->Insert(dedupe.keys[i], buffer + i * 16);
+    } else if (source >= 0) {
+      memcpy(buffer + i * 16, buffer + source * 16, 16);
+    }
+  }
+}
+
 void encode_astc_image(const astc_codec_image* input_image, int xdim, int ydim,
                        int zdim, const error_weighting_params* ewp,
                        astc_decode_mode decode_mode, swizzlepattern swz_encode,
-                       int threadcount, uint8_t** out_data, size_t* out_size) {
+                       int threadcount, const std::string& settings,
+                       AstcBlockCache* cache, uint8_t** out_data,
+                       size_t* out_size) {
   int xsize = input_image->xsize;
   int ysize = input_image->ysize;
   int zsize = input_image->zsize;
@@ -964,11 +1081,15 @@ void encode_astc_image(const astc_codec_image* input_image, int xdim, int ydim,
   int yblocks = (ysize + ydim - 1) / ydim;
   int zblocks = (zsize + zdim - 1) / zdim;
 
+  // Callers release the blocks with delete[].
   const size_t buffer_size = xblocks * yblocks * zblocks * 16;
-  uint8_t* buffer = (uint8_t*)malloc(buffer_size);
-  if (!buffer) {
-    std::cout << "Ran out of memory" << std::endl;
-    exit(1);
+  uint8_t* buffer = new uint8_t[buffer_size];
+
+  std::vector<uint8_t> block_mask(xblocks * yblocks * zblocks, 1);
+  BlockDedupe dedupe;
+  if (cache) {
+    PrepareBlockDedupe(input_image, xdim, ydim, decode_mode, settings,
+                       swz_encode, cache, buffer, block_mask.data(), &dedupe);
   }
 
   if (!suppress_progress_counter) {
@@ -976,7 +1097,12 @@ void encode_astc_image(const astc_codec_image* input_image, int xdim, int ydim,
   }
 
   encode_astc_image(input_image, NULL, xdim, ydim, zdim, ewp, decode_mode,
-                    swz_encode, swz_encode, buffer, 0, threadcount);
+                    swz_encode, swz_encode, buffer, 0, threadcount,
+                    block_mask.data());
+
+  if (cache) {
+    FinishBlockDedupe(dedupe, cache, buffer);
+  }
 
   *out_data = buffer;
   *out_size = buffer_size;
@@ -1006,6 +1132,13 @@ void encode_astc_image(const astc_codec_image* input_image, int xdim, int ydim,
   free(buffer);*/
 }
 
+int64_t GetAstcCodecImageSize(const astc_codec_image* image) {
+  const int64_t bytes_per_texel = image->imagedata16 ? 8 : 4;
+  return bytes_per_texel * (image->xsize + 2 * image->padding) *
+         (image->ysize + 2 * image->padding) *
+         (image->zsize == 1 ? 1 : image->zsize + 2 * image->padding);
+}
+
 astc_codec_image* CreateAstcCodecImageFromGl(const void* pixels, int size_x,
                                              int size_y, int size_z,
                                              uint32_t gl_format,
@@ -1043,22 +1176,27 @@ astc_codec_image* CreateAstcCodecImageFromGl(const void* pixels, int size_x,
   return astc_img;
 }
 
-void EncodeAstc(const void* pixels, int width, int height, uint32_t gl_format,
-                uint32_t gl_type, uint8_t** out_data, size_t* out_size,
-                int footprint_x, int footprint_y,
-                CompressionSpeed compression_speed) {
-  // initialization routines
-  prepare_angular_tables();
-  build_quantization_mode_table();
-  int footprint_z = 1;
-  int size_z = 1;
-
-  int thread_count = get_number_of_cpus();
-
-  enum astc_decode_mode decode_mode = DECODE_HDR;
-  //{DECODE_LDR_SRGB, DECODE_LDR, DECODE_HDR};
+astc_decode_mode GetDecodeMode(AstcProfile profile) {
+  switch (profile) {
+    case AstcProfile::kHdr:
+      return DECODE_HDR;
+    case AstcProfile::kLdr:
+      return DECODE_LDR;
+    case AstcProfile::kLdrSrgb:
+      return DECODE_LDR_SRGB;
+  }
+  assert(false);
+  return DECODE_HDR;
+}
 
-  error_weighting_params ewp;
+// Fills |ewp| for |compression_speed| and sets the global HDR flags used by
+// the encoder.
+void SetupErrorWeightingParams(CompressionSpeed compression_speed,
+                               int footprint_x, int footprint_y,
+                               int footprint_z, int components,
+                               astc_decode_mode decode_mode,
+                               error_weighting_params* ewp_out) {
+  error_weighting_params& ewp = *ewp_out;
 
   ewp.rgb_power = 1.0f;
   ewp.alpha_power = 1.0f;
@@ -1075,7 +1213,6 @@ void EncodeAstc(const void* pixels, int width, int height, uint32_t gl_format,
   ewp.alpha_radius = 0;
 
   ewp.block_artifact_suppression = 0.0f;
-  const int components = GetNumComponentsFromGlFormat(gl_format);
   ewp.rgba_weights[0] = 1.0f;
   ewp.rgba_weights[1] = components > 1 ? 1.0f : 0.0f;
   ewp.rgba_weights[2] = components > 2 ? 1.0f : 0.0f;
@@ -1089,8 +1226,6 @@ void EncodeAstc(const void* pixels, int width, int height, uint32_t gl_format,
     ewp.rgb_base_weight = 0;
     ewp.rgb_mean_weight = 1;
     ewp.alpha_base_weight = 0.05f;
-    rgb_force_use_of_hdr = 1;
-    alpha_force_use_of_hdr = 0;
   }
 
   int plimit_autoset = -1;
@@ -1137,20 +1272,284 @@ void EncodeAstc(const void* pixels, int width, int height, uint32_t gl_format,
   ewp.texel_avg_error_limit =
       std::pow(0.1f, dblimit * 0.1f) * 65535.0f * 65535.0f;
 
+  expand_block_artifact_suppression(footprint_x, footprint_y, footprint_z,
+                                    &ewp);
+}
+
+// The codec reads rgb_force_use_of_hdr and alpha_force_use_of_hdr as globals.
+// Encodes that need the same values may overlap, e.g. those of concurrent
+// bakes, while encodes that need different ones wait for each other.
+class ScopedHdrForcing {
+ public:
+  explicit ScopedHdrForcing(astc_decode_mode decode_mode)
+      : force_rgb_(decode_mode == DECODE_HDR) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() {
+      return num_active_ == 0 || active_ == force_rgb_;
+    });
+    if (num_active_ == 0) {
+      rgb_force_use_of_hdr = force_rgb_ ? 1 : 0;
+      alpha_force_use_of_hdr = 0;
+      active_ = force_rgb_;
+    }
+    ++num_active_;
+  }
+
+  ~ScopedHdrForcing() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--num_active_ == 0) {
+      changed_.notify_all();
+    }
+  }
+
+  ScopedHdrForcing(const ScopedHdrForcing&) = delete;
+  ScopedHdrForcing& operator=(const ScopedHdrForcing&) = delete;
+
+ private:
+  static std::mutex mutex_;
+  static std::condition_variable changed_;
+  static int num_active_;
+  static bool active_;
+
+  const bool force_rgb_;
+};
+
+std::mutex ScopedHdrForcing::mutex_;
+std::condition_variable ScopedHdrForcing::changed_;
+int ScopedHdrForcing::num_active_ = 0;
+bool ScopedHdrForcing::active_ = false;
+
+// The codec builds its tables on first use without locking, so they are
+// built here once so that images can be encoded concurrently.
+void PrepareAstcTables(int footprint_x, int footprint_y) {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    prepare_angular_tables();
+    build_quantization_mode_table();
+  });
+
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  get_block_size_descriptor(footprint_x, footprint_y, 1);
+  get_partition_table(footprint_x, footprint_y, 1, 0);
+}
+
+void EncodeAstc(const void* pixels, int width, int height, uint32_t gl_format,
+                uint32_t gl_type, uint8_t** out_data, size_t* out_size,
+                int footprint_x, int footprint_y,
+                CompressionSpeed compression_speed, AstcProfile profile,
+                AstcBlockCache* cache, int thread_count) {
+  PrepareAstcTables(footprint_x, footprint_y);
+  int footprint_z = 1;
+  int size_z = 1;
+
+  if (thread_count <= 0) {
+    thread_count = get_number_of_cpus();
+  }
+
+  const astc_decode_mode decode_mode = GetDecodeMode(profile);
+
+  error_weighting_params ewp;
+  const int components = GetNumComponentsFromGlFormat(gl_format);
+  SetupErrorWeightingParams(compression_speed, footprint_x, footprint_y,
+                            footprint_z, components, decode_mode, &ewp);
+
   swizzlepattern swz_encode = {0, 1, 2, 3};
 
   astc_codec_image* astc_img = CreateAstcCodecImageFromGl(
       pixels, width, height, size_z, gl_format, gl_type);
-
-  expand_block_artifact_suppression(footprint_x, footprint_y, footprint_z,
-                                    &ewp);
+  ScopedMemoryCharge image_charge(MemoryKind::kHost,
+                                  GetAstcCodecImageSize(astc_img));
 
   compute_averages_and_variances(astc_img, ewp.rgb_power, ewp.alpha_power,
                                  ewp.mean_stdev_radius, ewp.alpha_radius,
                                  swz_encode);
 
+  ScopedHdrForcing hdr_forcing(decode_mode);
+  const std::string settings =
+      "speed" + std::to_string(static_cast<int>(compression_speed));
   encode_astc_image(astc_img, footprint_x, footprint_y, footprint_z, &ewp,
-                    decode_mode, swz_encode, thread_count, out_data, out_size);
+                    decode_mode, swz_encode, thread_count, settings, cache,
+                    out_data, out_size);
+
+  destroy_image(astc_img);
+}
+
+void DecodeAstcBlock(astc_decode_mode decode_mode, int xdim, int ydim,
+                     const uint8_t* data, imageblock* pb) {
+  physical_compressed_block pcb;
+  memcpy(pcb.data, data, sizeof(pcb.data));
+  symbolic_compressed_block scb;
+  physical_to_symbolic(xdim, ydim, 1, pcb, &scb);
+  decompress_symbolic_block(decode_mode, xdim, ydim, 1, 0, 0, 0, &scb, pb);
+}
+
+// PSNR of the block at |block_x|, |block_y| of |data| against |input|. Only
+// texels inside the image and the first |components| channels count.
+float ComputeBlockPsnr(const astc_codec_image* input, const uint8_t* data,
+                       astc_decode_mode decode_mode, int xdim, int ydim,
+                       int block_x, int block_y, int components,
+                       swizzlepattern swz) {
+  imageblock original;
+  imageblock decoded;
+  fetch_imageblock(input, &original, xdim, ydim, 1, block_x * xdim,
+                   block_y * ydim, 0, swz);
+  DecodeAstcBlock(decode_mode, xdim, ydim, data, &decoded);
+
+  const int width = std::min(xdim, input->xsize - block_x * xdim);
+  const int height = std::min(ydim, input->ysize - block_y * ydim);
+  double squared_error = 0.0;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const int texel = y * xdim + x;
+      for (int c = 0; c < components; ++c) {
+        float a = original.orig_data[4 * texel + c];
+        float b = decoded.orig_data[4 * texel + c];
+        if (decode_mode == DECODE_HDR) {
+          a = std::log2(1.0f + std::max(a, 0.0f));
+          b = std::log2(1.0f + std::max(b, 0.0f));
+        }
+        squared_error += (a - b) * (a - b);
+      }
+    }
+  }
+  const double mse = squared_error / (width * height * components);
+  // Cap exact matches so they compare as better than any real error.
+  return static_cast<float>(-10.0 * std::log10(std::max(mse, 1e-12)));
+}
+
+void EncodeAstcWithQualityPolicy(const void* pixels, int width, int height,
+                                 uint32_t gl_format, uint32_t gl_type,
+                                 uint8_t** out_data, size_t* out_size,
+                                 int footprint_x, int footprint_y,
+                                 const AstcQualityPolicy& policy,
+                                 AstcProfile profile, AstcBlockCache* cache) {
+  PrepareAstcTables(footprint_x, footprint_y);
+  const int footprint_z = 1;
+  const int thread_count = get_number_of_cpus();
+  const astc_decode_mode decode_mode = GetDecodeMode(profile);
+  const int components = GetNumComponentsFromGlFormat(gl_format);
+  swizzlepattern swz_encode = {0, 1, 2, 3};
 
+  astc_codec_image* astc_img = CreateAstcCodecImageFromGl(
+      pixels, width, height, 1, gl_format, gl_type);
+  ScopedMemoryCharge image_charge(MemoryKind::kHost,
+                                  GetAstcCodecImageSize(astc_img));
+
+  const int xblocks = (width + footprint_x - 1) / footprint_x;
+  const int yblocks = (height + footprint_y - 1) / footprint_y;
+  const int num_blocks = xblocks * yblocks;
+  uint8_t* buffer = new uint8_t[num_blocks * 16];
+  uint8_t* retry_buffer = new uint8_t[num_blocks * 16];
+  std::vector<uint8_t> block_mask(num_blocks, 1);
+  std::vector<float> block_psnr(num_blocks, 0.0f);
+  BlockDedupe dedupe;
+  if (cache) {
+    const std::string settings =
+        "psnr" + std::to_string(policy.target_psnr_db) + "," +
+        std::to_string(static_cast<int>(policy.min_speed)) + "," +
+        std::to_string(static_cast<int>(policy.max_speed));
+    PrepareBlockDedupe(astc_img, footprint_x, footprint_y, decode_mode,
+                       settings, swz_encode, cache, buffer, block_mask.data(),
+                       &dedupe);
+  }
+
+  ScopedHdrForcing hdr_forcing(decode_mode);
+  const int min_speed = static_cast<int>(policy.min_speed);
+  const int max_speed = std::max(min_speed, static_cast<int>(policy.max_speed));
+  for (int speed = min_speed; speed <= max_speed; ++speed) {
+    error_weighting_params ewp;
+    SetupErrorWeightingParams(static_cast<CompressionSpeed>(speed),
+                              footprint_x, footprint_y, footprint_z,
+                              components, decode_mode, &ewp);
+    if (speed == min_speed) {
+      // The averages only depend on parameters shared by all speeds.
+      compute_averages_and_variances(astc_img, ewp.rgb_power, ewp.alpha_power,
+                                     ewp.mean_stdev_radius, ewp.alpha_radius,
+                                     swz_encode);
+    }
+
+    const bool first_pass = speed == min_speed;
+    uint8_t* target = first_pass ? buffer : retry_buffer;
+    encode_astc_image(astc_img, NULL, footprint_x, footprint_y, footprint_z,
+                      &ewp, decode_mode, swz_encode, swz_encode, target, 0,
+                      thread_count, block_mask.data());
+
+    // Keep the better of the old and new encoding and mark the blocks that
+    // still miss the target for the next speed.
+    int num_retries = 0;
+    for (int i = 0; i < num_blocks; ++i) {
+      num_retries += block_mask[i];
+    }
+    ParallelFor(num_blocks, [&](int i) {
+      if (!block_mask[i]) {
+        return;
+      }
+      const float psnr = ComputeBlockPsnr(
+          astc_img, target + i * 16, decode_mode, footprint_x, footprint_y,
+          i % xblocks, i / xblocks, components, swz_encode);
+      if (first_pass || psnr > block_psnr[i]) {
+        block_psnr[i] = psnr;
+        if (!first_pass) {
+          memcpy(buffer + i * 16, target + i * 16, 16);
+        }
+      }
+      block_mask[i] = block_psnr[i] < policy.target_psnr_db;
+    });
+    if (!suppress_progress_counter) {
+      printf("Encoded %d of %d blocks at speed %d\n", num_retries, num_blocks,
+             speed);
+    }
+
+    bool done = true;
+    for (int i = 0; i < num_blocks; ++i) {
+      if (block_mask[i]) {
+        done = false;
+        break;
+      }
+    }
+    if (done) {
+      break;
+    }
+  }
+
+  if (cache) {
+    FinishBlockDedupe(dedupe, cache, buffer);
+  }
+
+  delete[] retry_buffer;
   destroy_image(astc_img);
-}
\ No newline at end of file
+  *out_data = buffer;
+  *out_size = num_blocks * 16;
+}
+
+void DecodeAstc(const uint8_t* data, int width, int height, int footprint_x,
+                int footprint_y, AstcProfile profile, float* out_rgba) {
+  PrepareAstcTables(footprint_x, footprint_y);
+  const astc_decode_mode decode_mode = GetDecodeMode(profile);
+  const int xblocks = (width + footprint_x - 1) / footprint_x;
+  const int yblocks = (height + footprint_y - 1) / footprint_y;
+
+  ParallelFor(xblocks * yblocks, [&](int i) {
+    const int block_x = i % xblocks;
+    const int block_y = i / xblocks;
+    imageblock decoded;
+    DecodeAstcBlock(decode_mode, footprint_x, footprint_y, data + i * 16,
+                    &decoded);
+    for (int y = 0; y < footprint_y; ++y) {
+      const int image_y = block_y * footprint_y + y;
+      if (image_y >= height) {
+        break;
+      }
+      for (int x = 0; x < footprint_x; ++x) {
+        const int image_x = block_x * footprint_x + x;
+        if (image_x >= width) {
+          break;
+        }
+        memcpy(out_rgba + 4 * (image_y * width + image_x),
+               decoded.orig_data + 4 * (y * footprint_x + x),
+               4 * sizeof(float));
+      }
+    }
+  });
+}
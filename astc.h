@@ -1,17 +1,92 @@
 #pragma once
 
 #include <astc_codec_internals.h>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
-enum class CompressionSpeed {
-  kVeryFast = 0,
-  kFast,
-  kMedium,
-  kThorough,
-  kExhaustive,
+#include "compression_speed.h"
+
+// Color profile the blocks are encoded for. The LDR profiles are much faster to
+// encode and are meant for 8 bit input such as RGBM encoded cubemaps.
+enum class AstcProfile {
+  kHdr = 0,
+  kLdr,
+  kLdrSrgb,
+};
+
+// Encoded blocks keyed by their input texels and the encoder settings. Flat
+// regions and low mips repeat the same blocks many times, so a cache shared by
+// all faces and images saves encoding them again. Thread safe.
+class AstcBlockCache {
+ public:
+  struct Stats {
+    // Blocks copied from the cache or from an identical block of the image.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  // The cache is cleared when it grows past |max_entries|.
+  explicit AstcBlockCache(size_t max_entries = 1 << 20);
+
+  bool Find(const std::string& key, uint8_t* block) const;
+  void Insert(const std::string& key, const uint8_t* block);
+
+  void AddStats(uint64_t hits, uint64_t misses);
+  Stats GetStats() const;
+
+ private:
+  struct Block {
+    uint8_t data[16];
+  };
+
+  const size_t max_entries_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Block> blocks_;
+  Stats stats_;
 };
 
+// The 2D block footprints of KHR_texture_compression_astc_ldr.
+struct AstcFootprint {
+  int x;
+  int y;
+};
+static const AstcFootprint kAstcFootprints[] = {
+    {4, 4},  {5, 4},  {5, 5},  {6, 5},   {6, 6},   {8, 5},   {8, 6},
+    {8, 8},  {10, 5}, {10, 6}, {10, 8},  {10, 10}, {12, 10}, {12, 12},
+};
+
+// |thread_count| of 0 uses all CPUs. Images can be encoded concurrently as
+// long as all of them use the same |profile|.
 void EncodeAstc(
     const void* pixels, int width, int height, uint32_t gl_format,
     uint32_t gl_type, uint8_t** out_data, size_t* out_size, int footprint_x = 4,
     int footprint_y = 4,
-    CompressionSpeed compression_speed = CompressionSpeed::kExhaustive);
+    CompressionSpeed compression_speed = CompressionSpeed::kExhaustive,
+    AstcProfile profile = AstcProfile::kHdr, AstcBlockCache* cache = nullptr,
+    int thread_count = 0);
+
+// Picks the compression speed per block from a target error. Every block is
+// first encoded at |min_speed| and blocks below |target_psnr_db| are encoded
+// again with slower presets up to |max_speed|, keeping the best result. LDR
+// error is measured on [0, 1] values and HDR error in stops, log2(1 + x).
+struct AstcQualityPolicy {
+  float target_psnr_db = 40.0f;
+  CompressionSpeed min_speed = CompressionSpeed::kFast;
+  CompressionSpeed max_speed = CompressionSpeed::kExhaustive;
+};
+
+void EncodeAstcWithQualityPolicy(const void* pixels, int width, int height,
+                                 uint32_t gl_format, uint32_t gl_type,
+                                 uint8_t** out_data, size_t* out_size,
+                                 int footprint_x, int footprint_y,
+                                 const AstcQualityPolicy& policy,
+                                 AstcProfile profile = AstcProfile::kHdr,
+                                 AstcBlockCache* cache = nullptr);
+
+// Decodes blocks written by EncodeAstc to |width| * |height| RGBA floats. HDR
+// blocks decode to linear values and LDR blocks to [0, 1].
+void DecodeAstc(const uint8_t* data, int width, int height, int footprint_x,
+                int footprint_y, AstcProfile profile, float* out_rgba);
@@ -0,0 +1,490 @@
+#include "baker.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+#include "brdf.h"
+#include "budget.h"
+#include "flags.h"
+#include "ibl.h"
+#include "memory.h"
+#include "trace.h"
+
+namespace {
+// Shared by all ASTC outputs so blocks repeated across faces and maps are only
+// encoded once. An entry of a 4x4 cache takes about 384 bytes; with a memory
+// budget the caches of |num_bakers| get at most a quarter of it together.
+size_t GetAstcCacheEntries(int num_bakers) {
+  size_t astc_cache_entries = 1 << 20;
+  if (GetMemoryBudget() > 0) {
+    astc_cache_entries = std::min<size_t>(
+        astc_cache_entries,
+        GetMemoryBudget() / 4 / 384 / std::max(num_bakers, 1));
+  }
+  return astc_cache_entries;
+}
+
+// Opens |name| on |sink|, lets |write| fill it and closes it again. Returns
+// false if the stream failed; a skipped file is not an error.
+bool WriteKtx(BakeSink* sink, const std::string& name,
+              const std::function<void(std::ostream* out)>& write) {
+  std::ostream* out = sink->OpenKtx(name);
+  if (!out) {
+    return true;
+  }
+  write(out);
+  const bool ok = !out->fail();
+  sink->CloseKtx(name);
+  return ok;
+}
+}  // namespace
+
+bool ParseBakeOption(const std::string& arg, BakeOptions* options,
+                     std::string* error) {
+  std::string value;
+  if (ParseFlag(arg.c_str(), "ktx_format", &value)) {
+    if (!PixelFormatFromString(value, &options->ktx_format)) {
+      *error = "Unknown ktx format: " + value;
+      return false;
+    }
+  } else if (ParseFlag(arg.c_str(), "irradiance_compression", &value)) {
+    if (!CompressedFormatFromString(value,
+                                    &options->irradiance_compression)) {
+      *error = "Unknown compression: " + value;
+      return false;
+    }
+  } else if (ParseFlag(arg.c_str(), "prefilter_compression", &value)) {
+    if (!CompressedFormatFromString(value, &options->prefilter_compression)) {
+      *error = "Unknown compression: " + value;
+      return false;
+    }
+  } else if (ParseFlag(arg.c_str(), "astc_target_psnr", &value)) {
+    char* end;
+    const float target_psnr_db = std::strtof(value.c_str(), &end);
+    if (value.empty() || *end) {
+      *error = "Invalid PSNR: " + value;
+      return false;
+    }
+    options->astc_policy.target_psnr_db = target_psnr_db;
+  } else if (arg == "--cpu_brdf") {
+    options->cpu_brdf = true;
+  } else if (arg == "--brdf_pack") {
+    options->brdf_pack = true;
+  } else if (arg == "--octahedral") {
+    options->octahedral = true;
+  } else if (arg == "--skip_cubemap") {
+    options->skip_cubemap = true;
+  } else if (arg == "--progressive") {
+    options->progressive = true;
+  } else if (ParseFlag(arg.c_str(), "progressive_time_limit_ms", &value)) {
+    char* end;
+    const double time_limit_ms = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end || time_limit_ms < 0) {
+      *error = "Invalid time limit: " + value;
+      return false;
+    }
+    options->progressive_time_limit_ms = time_limit_ms;
+  } else if (ParseFlag(arg.c_str(), "prefilter_tile_size", &value)) {
+    char* end;
+    const long tile_size = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end || tile_size < 0) {
+      *error = "Invalid tile size: " + value;
+      return false;
+    }
+    options->prefilter_tiles.tile_size = static_cast<int>(tile_size);
+  } else if (ParseFlag(arg.c_str(), "prefilter_samples", &value)) {
+    char* end;
+    const long num_samples = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end || num_samples < 1) {
+      *error = "Invalid sample count: " + value;
+      return false;
+    }
+    options->prefilter_samples = static_cast<int>(num_samples);
+  } else if (ParseFlag(arg.c_str(), "irradiance_sample_delta", &value)) {
+    char* end;
+    const float sample_delta = std::strtof(value.c_str(), &end);
+    if (value.empty() || *end || !(sample_delta > 0)) {
+      *error = "Invalid sample delta: " + value;
+      return false;
+    }
+    options->irradiance_sample_delta = sample_delta;
+  } else if (ParseFlag(arg.c_str(), "time_budget_ms", &value)) {
+    char* end;
+    const double time_budget_ms = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end || time_budget_ms < 0) {
+      *error = "Invalid time budget: " + value;
+      return false;
+    }
+    options->time_budget_ms = time_budget_ms;
+  } else {
+    *error = "Unknown argument: " + arg;
+    return false;
+  }
+  return true;
+}
+
+std::ostream* InMemoryBakeSink::OpenKtx(const std::string& name) {
+  stream_.reset(new std::ostringstream(std::ios::out | std::ios::binary));
+  return stream_.get();
+}
+
+void InMemoryBakeSink::CloseKtx(const std::string& name) {
+  ktx_files_[name] = stream_->str();
+  stream_.reset();
+}
+
+const std::string& InMemoryBakeSink::GetKtx(const std::string& name) const {
+  static const std::string kEmpty;
+  const auto it = ktx_files_.find(name);
+  return it != ktx_files_.end() ? it->second : kEmpty;
+}
+
+FileBakeSink::FileBakeSink(const std::string& directory, bool write_previews)
+    : directory_(directory), write_previews_(write_previews) {}
+
+std::ostream* FileBakeSink::OpenKtx(const std::string& name) {
+  const std::string path = GetPath(name) + ".ktx";
+  file_.open(path.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!file_.is_open()) {
+    std::cout << "Failed to open " << path << std::endl;
+    return nullptr;
+  }
+  paths_.push_back(path);
+  return &file_;
+}
+
+void FileBakeSink::CloseKtx(const std::string& name) { file_.close(); }
+
+void FileBakeSink::OnTexture(const std::string& name, unsigned int texture,
+                             int width, int height, int num_mips) {
+  if (!write_previews_) {
+    return;
+  }
+  const std::string path = GetPath(name);
+  if (name == "brdf") {
+    WriteBrdfToPng(path, texture, width, height);
+  } else if (num_mips == 1) {
+    WriteCubemapToFile(path, texture, width, height);
+  } else {
+    for (int mip = 0; mip < num_mips; ++mip) {
+      WriteCubemapToFile(path + "_" + std::to_string(mip), texture,
+                         std::max(1, width >> mip), std::max(1, height >> mip),
+                         mip);
+    }
+  }
+}
+
+void FileBakeSink::OnPreview(const std::string& name, unsigned int texture,
+                             int width, int height, int num_mips,
+                             float fraction) {
+  OnTexture(name + "_preview", texture, width, height, num_mips);
+}
+
+std::string FileBakeSink::GetPath(const std::string& name) const {
+  return directory_.empty() ? name : directory_ + "/" + name;
+}
+
+Baker::Baker(const BakeOptions& options, int num_bakers)
+    : options_(options), astc_cache_(GetAstcCacheEntries(num_bakers)) {}
+
+Baker::~Baker() {
+  for (const auto& entry : brdf_lut_textures_) {
+    DeleteTexture(entry.second);
+  }
+}
+
+bool Baker::Bake(const float* pixels, int width, int height,
+                 int num_components, BakeSink* sink) {
+  return BakeEquirectangular(
+      [&]() {
+        return UploadEquirectangularTexture(pixels, width, height,
+                                            num_components);
+      },
+      sink);
+}
+
+bool Baker::Bake(const ImageLoader& loader, BakeSink* sink) {
+  std::vector<float> pixels;
+  int width, height;
+  {
+    TraceScope trace("io", "ImageLoader");
+    if (!loader(&pixels, &width, &height)) {
+      return false;
+    }
+  }
+  ScopedMemoryCharge pixels_charge(MemoryKind::kHost,
+                                   pixels.size() * sizeof(float));
+  return Bake(pixels.data(), width, height, 3, sink);
+}
+
+bool Baker::BakeFile(const std::string& file, BakeSink* sink) {
+  // A face spans a quarter of the equirectangular width, so source detail past
+  // 4 * |cubemap_size| is never sampled.
+  return BakeEquirectangular(
+      [&]() {
+        return LoadEquirectangularTexture(file.c_str(),
+                                          4 * options_.cubemap_size);
+      },
+      sink);
+}
+
+bool Baker::BakeEquirectangular(const std::function<unsigned int()>& load,
+                                BakeSink* sink) {
+  if (options_.time_budget_ms <= 0) {
+    return BakeStages(load, sink);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  if (!costs_ ||
+      costs_->irradiance_compression != options_.irradiance_compression ||
+      costs_->prefilter_compression != options_.prefilter_compression) {
+    MemoryStage stage("calibration");
+    costs_.reset(new BakeCosts(CalibrateBakeCosts(options_)));
+  }
+  const double calibration_ms = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+  // Loading and decoding the source is often the largest cost of a small
+  // probe and doesn't depend on the fitted settings, so it is done first and
+  // what it took comes off the budget.
+  const auto load_start = std::chrono::steady_clock::now();
+  unsigned int source_texture;
+  {
+    MemoryStage stage("load");
+    source_texture = load();
+  }
+  if (!source_texture) {
+    return false;
+  }
+  const double load_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - load_start)
+                             .count();
+  const bool include_brdf = options_.brdf_size > 0 &&
+                            !brdf_lut_textures_.count(
+                                std::make_pair(options_.brdf_size,
+                                               options_.cpu_brdf));
+  const bool include_brdf_pack = options_.brdf_size > 0 &&
+                                 options_.brdf_pack &&
+                                 !brdf_packs_.count(options_.brdf_size);
+  const bool include_previews = sink->WritesPreviews();
+  const BakeOptions requested = options_;
+  options_ = FitBakeBudget(requested, *costs_,
+                           requested.time_budget_ms - calibration_ms - load_ms,
+                           include_brdf, include_previews, include_brdf_pack);
+  const double estimated_ms =
+      calibration_ms + load_ms + EstimateBakeMs(options_, *costs_, include_brdf,
+                                                include_previews,
+                                                include_brdf_pack);
+  std::cout << "Estimated " << estimated_ms << " ms of "
+            << requested.time_budget_ms << " ms with prefilter "
+            << options_.prefilter_size << "x" << options_.prefilter_samples
+            << ", irradiance " << options_.irradiance_size << "/"
+            << options_.irradiance_sample_delta << ", ASTC up to "
+            << CompressionSpeedToString(options_.astc_policy.max_speed)
+            << std::endl;
+  const KtxMetadata settings = GetBakeSettingsMetadata(
+      options_, requested.time_budget_ms, estimated_ms);
+  options_.ktx_metadata.insert(options_.ktx_metadata.end(), settings.begin(),
+                               settings.end());
+  const bool ok =
+      BakeStages([source_texture]() { return source_texture; }, sink);
+  options_ = requested;
+  return ok;
+}
+
+bool Baker::BakeStages(const std::function<unsigned int()>& load,
+                       BakeSink* sink) {
+  // Seamless sampling is needed for the lower mip levels of the prefilter
+  // map.
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  bool ok = true;
+
+  // The irradiance and prefilter maps sample |source_texture|, either the
+  // cubemap or the equirectangular texture itself.
+  const bool skip_cubemap = options_.skip_cubemap && !options_.progressive;
+  const SourceLayout layout =
+      skip_cubemap ? SourceLayout::kEquirectangular : SourceLayout::kCubemap;
+  unsigned int source_texture;
+  if (skip_cubemap) {
+    MemoryStage stage("source");
+    source_texture = load();
+    if (!source_texture) {
+      return false;
+    }
+    GenerateEquirectangularMipmaps(source_texture);
+  } else {
+    MemoryStage stage("cubemap");
+    const unsigned int equirectangular_texture = load();
+    if (!equirectangular_texture) {
+      return false;
+    }
+    const int size = options_.cubemap_size;
+    const unsigned int cubemap_texture = ConvertEquirectangularTextureToCubemap(
+        equirectangular_texture, size, size);
+    DeleteTexture(equirectangular_texture);
+    source_texture = cubemap_texture;
+    sink->OnTexture("cubemap", cubemap_texture, size, size, 1);
+    ok &= WriteKtx(sink, "cubemap", [&](std::ostream* out) {
+      WriteCubemapToKtx(out, "cubemap", cubemap_texture, size, size, 1,
+                        options_.ktx_format, options_.ktx_metadata);
+    });
+  }
+
+  unsigned int progressive_irradiance_texture = 0;
+  unsigned int progressive_prefilter_texture = 0;
+  if (options_.progressive) {
+    MemoryStage stage("progressive");
+    RenderProgressively(source_texture, sink, &progressive_irradiance_texture,
+                        &progressive_prefilter_texture);
+  }
+
+  {
+    MemoryStage stage("irradiance");
+    const int size = options_.irradiance_size;
+    const unsigned int irradiance_texture =
+        options_.progressive
+            ? progressive_irradiance_texture
+            : GenerateIrradianceMap(source_texture, size, size,
+                                    options_.irradiance_sample_delta, layout);
+    sink->OnTexture("irradiance", irradiance_texture, size, size, 1);
+    ok &= WriteKtx(sink, "irradiance", [&](std::ostream* out) {
+      WriteCubemapToKtx(out, "irradiance", irradiance_texture, size, size, 1,
+                        options_.ktx_format, options_.ktx_metadata);
+    });
+    if (options_.compress) {
+      const std::string name =
+          std::string("irradiance_") +
+          CompressedFormatToString(options_.irradiance_compression);
+      ok &= WriteKtx(sink, name, [&](std::ostream* out) {
+        WriteCubemapToKtxCompressedAs(options_.irradiance_compression, out,
+                                      name, irradiance_texture, size, size, 1,
+                                      options_.astc_policy, &astc_cache_,
+                                      options_.ktx_metadata);
+      });
+    }
+    DeleteTexture(irradiance_texture);
+  }
+
+  {
+    MemoryStage stage("prefilter");
+    const int size = options_.prefilter_size;
+    // The source isn't needed after the prefilter map.
+    const unsigned int prefilter_texture =
+        options_.progressive
+            ? progressive_prefilter_texture
+            : GeneratePreFilteredMap(source_texture, size, size,
+                                     options_.prefilter_samples,
+                                     options_.prefilter_tiles, layout);
+    DeleteTexture(source_texture);
+    if (!prefilter_texture) {
+      std::cout << "Prefiltering canceled" << std::endl;
+      return false;
+    }
+    const int num_mips = 1 + static_cast<int>(std::floor(std::log2(size)));
+    sink->OnTexture("prefilter", prefilter_texture, size, size, num_mips);
+    ok &= WriteKtx(sink, "prefilter", [&](std::ostream* out) {
+      WriteCubemapToKtx(out, "prefilter", prefilter_texture, size, size,
+                        num_mips, options_.ktx_format, options_.ktx_metadata);
+    });
+    if (options_.compress) {
+      const std::string name =
+          std::string("prefilter_") +
+          CompressedFormatToString(options_.prefilter_compression);
+      ok &= WriteKtx(sink, name, [&](std::ostream* out) {
+        WriteCubemapToKtxCompressedAs(options_.prefilter_compression, out,
+                                      name, prefilter_texture, size, size,
+                                      num_mips, options_.astc_policy,
+                                      &astc_cache_, options_.ktx_metadata);
+      });
+    }
+    if (options_.octahedral) {
+      const unsigned int octahedral_texture =
+          GenerateOctahedralMap(prefilter_texture, 2 * size, num_mips);
+      ok &= WriteKtx(sink, "prefilter_octahedral", [&](std::ostream* out) {
+        WriteOctahedralToKtx(out, "prefilter_octahedral", octahedral_texture,
+                             2 * size, num_mips, options_.ktx_format,
+                             options_.ktx_metadata);
+      });
+      DeleteTexture(octahedral_texture);
+    }
+    DeleteTexture(prefilter_texture);
+  }
+
+  if (options_.brdf_size > 0) {
+    MemoryStage stage("brdf");
+    const int size = options_.brdf_size;
+    unsigned int& brdf_lut_texture =
+        brdf_lut_textures_[std::make_pair(size, options_.cpu_brdf)];
+    if (!brdf_lut_texture && options_.cpu_brdf) {
+      const std::vector<float> pixels = IntegrateBrdfLookUpTable(size, size);
+      brdf_lut_texture = UploadBrdfLookUpTable(pixels.data(), size, size);
+    } else if (!brdf_lut_texture) {
+      brdf_lut_texture = GenerateBRDFLookUpTable(size, size);
+    }
+    sink->OnTexture("brdf", brdf_lut_texture, size, size, 1);
+    ok &= WriteKtx(sink, "brdf", [&](std::ostream* out) {
+      WriteBrdfToKtx(out, brdf_lut_texture, size, size,
+                     options_.ktx_metadata);
+    });
+  }
+
+  if (options_.brdf_size > 0 && options_.brdf_pack) {
+    MemoryStage stage("brdf_pack");
+    const int size = options_.brdf_size;
+    std::vector<float>& brdf_pack = brdf_packs_[size];
+    if (brdf_pack.empty()) {
+      brdf_pack = IntegrateBrdfLutPack(size, size);
+    }
+    ScopedMemoryCharge pack_charge(MemoryKind::kHost,
+                                   brdf_pack.size() * sizeof(float));
+    ok &= WriteKtx(sink, "brdf_pack", [&](std::ostream* out) {
+      WriteBrdfPackToKtx(out, brdf_pack.data(), size, size,
+                         options_.ktx_metadata);
+    });
+  }
+  return ok;
+}
+
+void Baker::RenderProgressively(unsigned int cubemap, BakeSink* sink,
+                                unsigned int* irradiance_texture,
+                                unsigned int* prefilter_texture) {
+  const auto start = std::chrono::steady_clock::now();
+  ProgressiveMap irradiance(ProgressiveMap::kIrradiance, cubemap,
+                            options_.irradiance_size);
+  ProgressiveMap prefilter(ProgressiveMap::kPrefilter, cubemap,
+                           options_.prefilter_size);
+  const auto preview = [sink](const char* name, const ProgressiveMap& map,
+                              int size) {
+    const unsigned int texture = map.Resolve();
+    sink->OnPreview(name, texture, size, size, map.num_mips(), map.fraction());
+    DeleteTexture(texture);
+  };
+  // Both maps take the same number of passes.
+  for (;;) {
+    irradiance.Refine();
+    prefilter.Refine();
+    if (prefilter.done()) {
+      break;
+    }
+    if (options_.progressive_time_limit_ms > 0) {
+      glFinish();
+      const double elapsed_ms = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+      if (elapsed_ms >= options_.progressive_time_limit_ms) {
+        std::cout << "Progressive time limit reached with "
+                  << prefilter.fraction() * 100 << "% of the samples"
+                  << std::endl;
+        break;
+      }
+    }
+    preview("irradiance", irradiance, options_.irradiance_size);
+    preview("prefilter", prefilter, options_.prefilter_size);
+  }
+  *irradiance_texture = irradiance.Resolve();
+  *prefilter_texture = prefilter.Resolve();
+}
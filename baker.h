@@ -0,0 +1,209 @@
+#pragma once
+
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "astc.h"
+#include "ibl.h"
+#include "pixel_formats.h"
+#include "writers.h"
+
+// In-process API of the whole pipeline: an equirectangular source in, the
+// cubemap, irradiance, prefilter and BRDF KTX files out. The outputs go to a
+// BakeSink, so they can be kept in memory or streamed to files.
+
+struct BakeOptions {
+  int cubemap_size = 512;
+  int irradiance_size = 32;
+  int prefilter_size = 512;
+  // 0 skips the BRDF lookup table, which doesn't depend on the source.
+  int brdf_size = 512;
+  // Integrates the BRDF lookup table on the CPU threads, see brdf.h, rather
+  // than rendering it.
+  bool cpu_brdf = false;
+  // Also writes "brdf_pack", the RGBA16F table of the split-sum, multi-scatter
+  // and sheen terms of IntegrateBrdfLutPack(), at |brdf_size|.
+  bool brdf_pack = false;
+  // Also writes the prefilter map as "prefilter_octahedral", a 2D KTX with
+  // the octahedral map of every mip, see GenerateOctahedralMap(), in
+  // |ktx_format|.
+  bool octahedral = false;
+  // Format of the uncompressed cubemap, irradiance and prefilter KTX files.
+  PixelFormat ktx_format = PixelFormat::kRgba16f;
+  // Whether to also write compressed irradiance and prefilter KTX files.
+  bool compress = true;
+  CompressedFormat irradiance_compression = CompressedFormat::kAstc;
+  CompressedFormat prefilter_compression = CompressedFormat::kAstc;
+  AstcQualityPolicy astc_policy;
+  // Splits the prefilter passes into tiles, reports their progress and lets
+  // the bake be canceled. A canceled bake fails.
+  TileOptions prefilter_tiles;
+  // Renders the irradiance and prefilter maps progressively, see
+  // ProgressiveMap, and previews both after every pass.
+  bool progressive = false;
+  // Samples the irradiance and prefilter maps straight from the mip-mapped
+  // equirectangular source instead of converting it to a cubemap first, which
+  // skips the conversion, its memory and the "cubemap" output. |cubemap_size|
+  // still limits the resolution files are loaded at. Not used by progressive
+  // bakes.
+  bool skip_cubemap = false;
+  // Stops refining the progressive maps after this long and outputs them with
+  // the samples taken so far. 0 takes all samples.
+  double progressive_time_limit_ms = 0;
+  // Sample counts of the irradiance and prefilter maps, see ibl.h.
+  // Progressive bakes always take the defaults.
+  float irradiance_sample_delta = kDefaultIrradianceSampleDelta;
+  int prefilter_samples = kDefaultPrefilterSamples;
+  // Lowers the sample counts, sizes and ASTC speed until the bake is
+  // estimated to take at most this long, see budget.h, and turns off
+  // progressive rendering. The settings chosen are added to the KTX metadata.
+  // 0 bakes with the options as given.
+  double time_budget_ms = 0;
+  // Stored in the header of every KTX file.
+  KtxMetadata ktx_metadata;
+};
+
+// Parses a bake option given as a command line flag, e.g.
+// "--ktx_format=rgb9e5". Returns false and sets |error| if |arg| is not a
+// valid bake option.
+bool ParseBakeOption(const std::string& arg, BakeOptions* options,
+                     std::string* error);
+
+// Receives the outputs of a bake as they are produced.
+class BakeSink {
+ public:
+  virtual ~BakeSink() {}
+
+  // Returns the stream for the KTX file |name|, e.g. "irradiance" or
+  // "prefilter_astc", or null to skip it. The stream is written until
+  // CloseKtx() is called for the same name.
+  virtual std::ostream* OpenKtx(const std::string& name) = 0;
+  virtual void CloseKtx(const std::string& name) = 0;
+
+  // Called with the GL texture of each stage before it is deleted, e.g. to
+  // write previews. |name| is "cubemap", "irradiance", "prefilter" or "brdf".
+  virtual void OnTexture(const std::string& name, unsigned int texture,
+                         int width, int height, int num_mips) {}
+  // Whether OnTexture() writes PNG previews, which bakes with a time budget
+  // then leave time for.
+  virtual bool WritesPreviews() const { return false; }
+
+  // Called in progressive bakes with the "irradiance" and "prefilter" maps
+  // after each but the last pass, with |fraction| of the samples taken. The
+  // texture is deleted after the call.
+  virtual void OnPreview(const std::string& name, unsigned int texture,
+                         int width, int height, int num_mips, float fraction) {
+  }
+};
+
+// Keeps the KTX files in memory.
+class InMemoryBakeSink : public BakeSink {
+ public:
+  std::ostream* OpenKtx(const std::string& name) override;
+  void CloseKtx(const std::string& name) override;
+
+  // Returns the KTX file |name| or an empty string if it wasn't produced.
+  const std::string& GetKtx(const std::string& name) const;
+  const std::map<std::string, std::string>& ktx_files() const {
+    return ktx_files_;
+  }
+
+ private:
+  std::unique_ptr<std::ostringstream> stream_;
+  std::map<std::string, std::string> ktx_files_;
+};
+
+// Writes the KTX files to |directory|, or the working directory if it is
+// empty, and optionally PNG previews of every stage next to them.
+class FileBakeSink : public BakeSink {
+ public:
+  FileBakeSink(const std::string& directory, bool write_previews);
+
+  std::ostream* OpenKtx(const std::string& name) override;
+  void CloseKtx(const std::string& name) override;
+  void OnTexture(const std::string& name, unsigned int texture, int width,
+                 int height, int num_mips) override;
+  bool WritesPreviews() const override { return write_previews_; }
+  // Overwrites "<name>_preview" PNGs if previews are written.
+  void OnPreview(const std::string& name, unsigned int texture, int width,
+                 int height, int num_mips, float fraction) override;
+
+  // Paths of the KTX files written so far.
+  const std::vector<std::string>& paths() const { return paths_; }
+
+ private:
+  std::string GetPath(const std::string& name) const;
+
+  const std::string directory_;
+  const bool write_previews_;
+  std::ofstream file_;
+  std::vector<std::string> paths_;
+};
+
+struct BakeCosts;
+
+// Loads an equirectangular image as tightly packed RGB floats, with rows
+// starting at the bottom. Returns false on failure.
+typedef std::function<bool(std::vector<float>* pixels, int* width,
+                           int* height)>
+    ImageLoader;
+
+// Runs the pipeline on the current OpenGL context. A Baker can be reused for
+// many sources, which then share its ASTC block cache and BRDF lookup tables.
+// It must be destroyed while the context is still current.
+class Baker {
+ public:
+  // |num_bakers| is the number of bakers that run at the same time under the
+  // memory budget, e.g. one per context of a BakeScheduler. Their ASTC block
+  // caches share a quarter of the budget.
+  explicit Baker(const BakeOptions& options, int num_bakers = 1);
+  ~Baker();
+
+  Baker(const Baker&) = delete;
+  Baker& operator=(const Baker&) = delete;
+
+  // Bakes |pixels|, tightly packed floats with |num_components| per pixel and
+  // rows starting at the bottom. Returns false if the bake failed.
+  bool Bake(const float* pixels, int width, int height, int num_components,
+            BakeSink* sink);
+  bool Bake(const ImageLoader& loader, BakeSink* sink);
+  // Loads a .hdr or .exr |file| at the resolution the cubemap needs.
+  bool BakeFile(const std::string& file, BakeSink* sink);
+
+  const BakeOptions& options() const { return options_; }
+  // Applies to the following bakes.
+  void set_options(const BakeOptions& options) { options_ = options; }
+  AstcBlockCache::Stats GetAstcCacheStats() const {
+    return astc_cache_.GetStats();
+  }
+
+ private:
+  // Bakes everything from the equirectangular texture |load| returns, or fails
+  // if it returns 0. Fits the options to the time budget first, if there is
+  // one.
+  bool BakeEquirectangular(const std::function<unsigned int()>& load,
+                           BakeSink* sink);
+  bool BakeStages(const std::function<unsigned int()>& load, BakeSink* sink);
+  // Renders the irradiance and prefilter maps of |cubemap| progressively,
+  // previewing them on |sink|.
+  void RenderProgressively(unsigned int cubemap, BakeSink* sink,
+                           unsigned int* irradiance_texture,
+                           unsigned int* prefilter_texture);
+
+  BakeOptions options_;
+  AstcBlockCache astc_cache_;
+  // The BRDF lookup table doesn't depend on the source, so each size is only
+  // integrated once per integrator, keyed by size and cpu_brdf.
+  std::map<std::pair<int, bool>, unsigned int> brdf_lut_textures_;
+  std::map<int, std::vector<float>> brdf_packs_;
+  // Measured on the first bake with a time budget and again when the
+  // compressed formats change.
+  std::unique_ptr<BakeCosts> costs_;
+};
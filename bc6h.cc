@@ -0,0 +1,444 @@
+#include "bc6h.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "parallel.h"
+#include "pixel_formats.h"
+
+// Enums copied from GL/GL.h
+#define GL_RGB 0x1907
+#define GL_RGBA 0x1908
+#define GL_HALF_FLOAT 0x140B
+#define GL_FLOAT 0x1406
+
+namespace {
+// Interpolation weights of the 4 bit index modes.
+const int kWeights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                          34, 38, 43, 47, 51, 55, 60, 64};
+
+// The two single region modes used by the encoder. Mode 11 stores two 10 bit
+// endpoints, mode 12 stores an 11 bit endpoint and a 9 bit signed delta.
+struct Bc6hMode {
+  int mode_value;
+  int endpoint_bits;
+  int delta_bits;  // 0 if the endpoints are not delta encoded.
+};
+const Bc6hMode kMode11 = {0x03, 10, 0};
+const Bc6hMode kMode12 = {0x07, 11, 9};
+
+struct SpeedParameters {
+  int refine_iterations;
+  int search_radius;
+  bool try_delta_mode;
+};
+
+SpeedParameters GetSpeedParameters(CompressionSpeed speed) {
+  switch (speed) {
+    case CompressionSpeed::kVeryFast:
+      return {0, 0, false};
+    case CompressionSpeed::kFast:
+      return {1, 0, false};
+    case CompressionSpeed::kMedium:
+      return {2, 1, true};
+    case CompressionSpeed::kThorough:
+      return {3, 1, true};
+    case CompressionSpeed::kExhaustive:
+      return {4, 2, true};
+  }
+  assert(false);
+  return {0, 0, false};
+}
+
+// 16 texels as unsigned half float bits in [0, 0x7BFF].
+struct InputBlock {
+  int texels[16][3];
+};
+
+struct EncodedBlock {
+  int endpoints[2][3];
+  int indices[16];
+  int64_t error;
+};
+
+int ClampHalf(uint16_t half) {
+  // Negative values and NaN are not representable in unsigned BC6H.
+  if ((half & 0x8000) || (half & 0x7C00) == 0x7C00) {
+    return (half & 0x8000) || (half & 0x3FF) ? 0 : 0x7BFF;
+  }
+  return half;
+}
+
+int Unquantize(int value, int bits) {
+  if (bits >= 15 || value == 0) {
+    return value;
+  }
+  if (value == (1 << bits) - 1) {
+    return 0xFFFF;
+  }
+  return ((value << 16) + 0x8000) >> bits;
+}
+
+int FinishUnquantize(int value) { return (value * 31) >> 6; }
+
+int Interpolate(int a, int b, int weight) {
+  return ((64 - weight) * a + weight * b + 32) >> 6;
+}
+
+// Maps half float bits to the unquantized 16 bit endpoint domain.
+float HalfToEndpointDomain(int half) {
+  return (static_cast<float>(half) + 0.5f) * (64.0f / 31.0f);
+}
+
+int QuantizeEndpoint(float value, int bits) {
+  const int max_value = (1 << bits) - 1;
+  const int guess = std::min(
+      max_value,
+      std::max(0, static_cast<int>(value / static_cast<float>(1 << (16 - bits)))));
+  int best = guess;
+  float best_error = std::numeric_limits<float>::max();
+  for (int candidate = std::max(0, guess - 1);
+       candidate <= std::min(max_value, guess + 1); ++candidate) {
+    const float error =
+        std::fabs(static_cast<float>(Unquantize(candidate, bits)) - value);
+    if (error < best_error) {
+      best_error = error;
+      best = candidate;
+    }
+  }
+  return best;
+}
+
+// Pulls the second endpoint into the range of the delta encoding.
+void ClampDelta(const Bc6hMode& mode, int endpoints[2][3]) {
+  if (mode.delta_bits == 0) {
+    return;
+  }
+  const int min_delta = -(1 << (mode.delta_bits - 1));
+  const int max_delta = (1 << (mode.delta_bits - 1)) - 1;
+  for (int c = 0; c < 3; ++c) {
+    endpoints[1][c] = std::min(endpoints[0][c] + max_delta,
+                               std::max(endpoints[0][c] + min_delta,
+                                        endpoints[1][c]));
+  }
+}
+
+bool IsDeltaValid(const Bc6hMode& mode, const int endpoints[2][3]) {
+  if (mode.delta_bits == 0) {
+    return true;
+  }
+  const int min_delta = -(1 << (mode.delta_bits - 1));
+  const int max_delta = (1 << (mode.delta_bits - 1)) - 1;
+  for (int c = 0; c < 3; ++c) {
+    const int delta = endpoints[1][c] - endpoints[0][c];
+    if (delta < min_delta || delta > max_delta) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Picks the best palette entry for every texel and returns the total squared
+// error in half float bits.
+int64_t AssignIndices(const InputBlock& block, const Bc6hMode& mode,
+                      const int endpoints[2][3], int* indices) {
+  int palette[16][3];
+  for (int c = 0; c < 3; ++c) {
+    const int a = Unquantize(endpoints[0][c], mode.endpoint_bits);
+    const int b = Unquantize(endpoints[1][c], mode.endpoint_bits);
+    for (int i = 0; i < 16; ++i) {
+      palette[i][c] = FinishUnquantize(Interpolate(a, b, kWeights[i]));
+    }
+  }
+
+  int64_t total_error = 0;
+  for (int t = 0; t < 16; ++t) {
+    int64_t best_error = std::numeric_limits<int64_t>::max();
+    int best_index = 0;
+    for (int i = 0; i < 16; ++i) {
+      int64_t error = 0;
+      for (int c = 0; c < 3; ++c) {
+        const int64_t diff = palette[i][c] - block.texels[t][c];
+        error += diff * diff;
+      }
+      if (error < best_error) {
+        best_error = error;
+        best_index = i;
+      }
+    }
+    indices[t] = best_index;
+    total_error += best_error;
+  }
+  return total_error;
+}
+
+// Initial endpoints along the principal axis of the block.
+void ComputePrincipalEndpoints(const InputBlock& block, float out[2][3]) {
+  float values[16][3];
+  float mean[3] = {0.0f, 0.0f, 0.0f};
+  for (int t = 0; t < 16; ++t) {
+    for (int c = 0; c < 3; ++c) {
+      values[t][c] = HalfToEndpointDomain(block.texels[t][c]);
+      mean[c] += values[t][c] / 16.0f;
+    }
+  }
+
+  float covariance[3][3] = {};
+  for (int t = 0; t < 16; ++t) {
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        covariance[i][j] += (values[t][i] - mean[i]) * (values[t][j] - mean[j]);
+      }
+    }
+  }
+
+  // Power iteration.
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[3];
+    float length = 0.0f;
+    for (int i = 0; i < 3; ++i) {
+      next[i] = covariance[i][0] * axis[0] + covariance[i][1] * axis[1] +
+                covariance[i][2] * axis[2];
+      length = std::max(length, std::fabs(next[i]));
+    }
+    if (length <= 0.0f) {
+      break;
+    }
+    for (int i = 0; i < 3; ++i) {
+      axis[i] = next[i] / length;
+    }
+  }
+
+  float min_projection = 0.0f;
+  float max_projection = 0.0f;
+  const float axis_length_squared =
+      axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+  for (int t = 0; t < 16; ++t) {
+    float projection = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+      projection += (values[t][c] - mean[c]) * axis[c];
+    }
+    projection /= axis_length_squared;
+    min_projection = std::min(min_projection, projection);
+    max_projection = std::max(max_projection, projection);
+  }
+
+  for (int c = 0; c < 3; ++c) {
+    out[0][c] = mean[c] + axis[c] * min_projection;
+    out[1][c] = mean[c] + axis[c] * max_projection;
+  }
+}
+
+// Least squares fit of the endpoints for fixed indices.
+void RefitEndpoints(const InputBlock& block, const int* indices,
+                    float out[2][3]) {
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ax[3] = {0.0f, 0.0f, 0.0f};
+  float bx[3] = {0.0f, 0.0f, 0.0f};
+  for (int t = 0; t < 16; ++t) {
+    const float beta = kWeights[indices[t]] / 64.0f;
+    const float alpha = 1.0f - beta;
+    aa += alpha * alpha;
+    ab += alpha * beta;
+    bb += beta * beta;
+    for (int c = 0; c < 3; ++c) {
+      const float value = HalfToEndpointDomain(block.texels[t][c]);
+      ax[c] += alpha * value;
+      bx[c] += beta * value;
+    }
+  }
+
+  const float determinant = aa * bb - ab * ab;
+  if (std::fabs(determinant) < 1e-6f) {
+    return;
+  }
+  for (int c = 0; c < 3; ++c) {
+    out[0][c] = (ax[c] * bb - bx[c] * ab) / determinant;
+    out[1][c] = (bx[c] * aa - ax[c] * ab) / determinant;
+  }
+}
+
+void QuantizeEndpoints(const Bc6hMode& mode, const float in[2][3],
+                       int out[2][3]) {
+  for (int e = 0; e < 2; ++e) {
+    for (int c = 0; c < 3; ++c) {
+      out[e][c] = QuantizeEndpoint(std::min(65535.0f, std::max(0.0f, in[e][c])),
+                                   mode.endpoint_bits);
+    }
+  }
+  ClampDelta(mode, out);
+}
+
+bool EncodeWithMode(const InputBlock& block, const Bc6hMode& mode,
+                    const SpeedParameters& params, EncodedBlock* out) {
+  float endpoints[2][3];
+  ComputePrincipalEndpoints(block, endpoints);
+
+  EncodedBlock best;
+  QuantizeEndpoints(mode, endpoints, best.endpoints);
+  best.error = AssignIndices(block, mode, best.endpoints, best.indices);
+
+  for (int iteration = 0; iteration < params.refine_iterations; ++iteration) {
+    EncodedBlock candidate;
+    RefitEndpoints(block, best.indices, endpoints);
+    QuantizeEndpoints(mode, endpoints, candidate.endpoints);
+    candidate.error =
+        AssignIndices(block, mode, candidate.endpoints, candidate.indices);
+    if (candidate.error >= best.error) {
+      break;
+    }
+    best = candidate;
+  }
+
+  // Greedy search around the quantized endpoints.
+  const int max_value = (1 << mode.endpoint_bits) - 1;
+  for (int radius = 1; radius <= params.search_radius && best.error > 0;
+       ++radius) {
+    for (int e = 0; e < 2; ++e) {
+      for (int c = 0; c < 3; ++c) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+          EncodedBlock candidate = best;
+          const int value = best.endpoints[e][c] + sign * radius;
+          if (value < 0 || value > max_value) {
+            continue;
+          }
+          candidate.endpoints[e][c] = value;
+          if (!IsDeltaValid(mode, candidate.endpoints)) {
+            continue;
+          }
+          candidate.error =
+              AssignIndices(block, mode, candidate.endpoints, candidate.indices);
+          if (candidate.error < best.error) {
+            best = candidate;
+          }
+        }
+      }
+    }
+  }
+
+  // The most significant bit of the first index is implied to be 0.
+  if (best.indices[0] & 8) {
+    for (int c = 0; c < 3; ++c) {
+      std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+    }
+    for (int t = 0; t < 16; ++t) {
+      best.indices[t] = 15 - best.indices[t];
+    }
+    if (!IsDeltaValid(mode, best.endpoints)) {
+      return false;
+    }
+  }
+
+  *out = best;
+  return true;
+}
+
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t* data) : data_(data), position_(0) {
+    memset(data_, 0, 16);
+  }
+
+  void Write(uint32_t value, int bits) {
+    for (int i = 0; i < bits; ++i, ++position_) {
+      if ((value >> i) & 1) {
+        data_[position_ >> 3] |= static_cast<uint8_t>(1 << (position_ & 7));
+      }
+    }
+  }
+
+ private:
+  uint8_t* data_;
+  int position_;
+};
+
+void PackBlock(const Bc6hMode& mode, const EncodedBlock& block, uint8_t* out) {
+  BitWriter writer(out);
+  writer.Write(mode.mode_value, 5);
+  for (int c = 0; c < 3; ++c) {
+    writer.Write(block.endpoints[0][c] & 0x3FF, 10);
+  }
+  if (mode.delta_bits == 0) {
+    for (int c = 0; c < 3; ++c) {
+      writer.Write(block.endpoints[1][c], 10);
+    }
+  } else {
+    // rx[8:0], rw[10], gx[8:0], gw[10], bx[8:0], bw[10].
+    for (int c = 0; c < 3; ++c) {
+      const int delta = block.endpoints[1][c] - block.endpoints[0][c];
+      writer.Write(delta & ((1 << mode.delta_bits) - 1), mode.delta_bits);
+      writer.Write(block.endpoints[0][c] >> 10, 1);
+    }
+  }
+
+  writer.Write(block.indices[0], 3);
+  for (int t = 1; t < 16; ++t) {
+    writer.Write(block.indices[t], 4);
+  }
+}
+
+void FetchBlock(const void* pixels, int width, int height, int components,
+                uint32_t gl_type, int block_x, int block_y, InputBlock* out) {
+  for (int y = 0; y < 4; ++y) {
+    const int py = std::min(block_y * 4 + y, height - 1);
+    for (int x = 0; x < 4; ++x) {
+      const int px = std::min(block_x * 4 + x, width - 1);
+      const size_t offset =
+          (static_cast<size_t>(py) * width + px) * components;
+      for (int c = 0; c < 3; ++c) {
+        uint16_t half;
+        if (gl_type == GL_FLOAT) {
+          half = FloatToHalf(static_cast<const float*>(pixels)[offset + c]);
+        } else {
+          half = static_cast<const uint16_t*>(pixels)[offset + c];
+        }
+        out->texels[y * 4 + x][c] = ClampHalf(half);
+      }
+    }
+  }
+}
+}  // namespace
+
+void EncodeBc6h(const void* pixels, int width, int height, uint32_t gl_format,
+                uint32_t gl_type, uint8_t** out_data, size_t* out_size,
+                CompressionSpeed compression_speed) {
+  assert(gl_format == GL_RGB || gl_format == GL_RGBA);
+  assert(gl_type == GL_FLOAT || gl_type == GL_HALF_FLOAT);
+  const int components = gl_format == GL_RGBA ? 4 : 3;
+  const SpeedParameters params = GetSpeedParameters(compression_speed);
+
+  const int blocks_x = (width + 3) / 4;
+  const int blocks_y = (height + 3) / 4;
+  const size_t buffer_size = static_cast<size_t>(blocks_x) * blocks_y * 16;
+  uint8_t* buffer = new uint8_t[buffer_size];
+
+  ParallelFor(blocks_y, [&](int block_y) {
+    for (int block_x = 0; block_x < blocks_x; ++block_x) {
+      InputBlock block;
+      FetchBlock(pixels, width, height, components, gl_type, block_x, block_y,
+                 &block);
+
+      EncodedBlock encoded;
+      EncodeWithMode(block, kMode11, params, &encoded);
+      const Bc6hMode* mode = &kMode11;
+      if (params.try_delta_mode && encoded.error > 0) {
+        EncodedBlock delta_encoded;
+        if (EncodeWithMode(block, kMode12, params, &delta_encoded) &&
+            delta_encoded.error < encoded.error) {
+          encoded = delta_encoded;
+          mode = &kMode12;
+        }
+      }
+
+      PackBlock(*mode, encoded,
+                buffer + (static_cast<size_t>(block_y) * blocks_x + block_x) * 16);
+    }
+  });
+
+  *out_data = buffer;
+  *out_size = buffer_size;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "compression_speed.h"
+
+// Encodes an RGB(A) float or half float image as BC6H unsigned float
+// (GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT). Alpha is ignored and negative values
+// are clamped to 0. |out_data| is allocated with new[] and holds 16 bytes per
+// 4x4 block in row-major block order.
+void EncodeBc6h(
+    const void* pixels, int width, int height, uint32_t gl_format,
+    uint32_t gl_type, uint8_t** out_data, size_t* out_size,
+    CompressionSpeed compression_speed = CompressionSpeed::kExhaustive);
@@ -0,0 +1,349 @@
+// Benchmarks the pipeline stages in isolation and prints the results as JSON.
+//
+//   bazel run //bench -- --sizes=64,128,256 --inputs=data/source.hdr
+//
+// The context is created headless through EGL, so the benchmark runs without a
+// display, e.g. on Mesa llvmpipe. A synthetic environment is always measured in
+// addition to the given inputs.
+#include <glad/glad.h>
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "astc.h"
+#include "bc6h.h"
+#include "flags.h"
+#include "gl_context.h"
+#include "ibl.h"
+#include "memory.h"
+#include "writers.h"
+
+// Defined by the ASTC encoder. The progress output would break the JSON.
+extern int suppress_progress_counter;
+
+namespace {
+struct Input {
+  std::string name;
+  unsigned int texture;
+};
+
+// A single stage at a single size. |run| returns a texture to delete after the
+// measurement or 0.
+struct Stage {
+  std::string name;
+  bool uses_gpu;
+  int size;
+  int64_t texels;
+  int64_t blocks;
+  std::function<unsigned int()> run;
+};
+
+struct Sample {
+  double wall_ms;
+  double gpu_ms;
+};
+
+std::vector<int> ParseIntList(const std::string& list) {
+  std::vector<int> values;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      values.push_back(std::stoi(item));
+    }
+  }
+  return values;
+}
+
+std::vector<std::string> ParseStringList(const std::string& list) {
+  std::vector<std::string> values;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      values.push_back(item);
+    }
+  }
+  return values;
+}
+
+// A sky-like environment with a small and very bright sun over a textured
+// ground, so the filters and encoders see a realistic dynamic range.
+std::vector<float> MakeSyntheticEnvironment(int width, int height) {
+  static const float kPi = 3.14159265358979f;
+  std::vector<float> pixels(width * height * 3);
+  for (int y = 0; y < height; ++y) {
+    // Rows start at the bottom, like images loaded by LoadHDRTexture().
+    const float elevation = (static_cast<float>(y) + 0.5f) / height - 0.5f;
+    for (int x = 0; x < width; ++x) {
+      const float azimuth = (static_cast<float>(x) + 0.5f) / width;
+      float* pixel = &pixels[(y * width + x) * 3];
+      if (elevation > 0.0f) {
+        const float t = std::min(1.0f, elevation * 2.0f);
+        pixel[0] = 0.9f - 0.6f * t;
+        pixel[1] = 1.0f - 0.4f * t;
+        pixel[2] = 1.2f;
+      } else {
+        const bool checker = (static_cast<int>(azimuth * 64.0f) +
+                              static_cast<int>(elevation * 32.0f)) & 1;
+        const float value = checker ? 0.25f : 0.1f;
+        pixel[0] = value;
+        pixel[1] = value * 0.8f;
+        pixel[2] = value * 0.6f;
+      }
+
+      // Sun at 30 degrees elevation.
+      const float dx = (azimuth - 0.3f) * 2.0f * kPi;
+      const float dy = (elevation - 1.0f / 6.0f) * kPi;
+      if (dx * dx + dy * dy < 0.05f * 0.05f) {
+        pixel[0] = 5000.0f;
+        pixel[1] = 4500.0f;
+        pixel[2] = 4000.0f;
+      }
+    }
+  }
+  return pixels;
+}
+
+// Peak resident set size of the process so far.
+int64_t GetPeakRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+Sample RunStage(const Stage& stage) {
+  GLuint query = 0;
+  if (stage.uses_gpu) {
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const unsigned int texture = stage.run();
+  glFinish();
+  const auto end = std::chrono::steady_clock::now();
+
+  Sample sample;
+  sample.wall_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+  sample.gpu_ms = 0.0;
+  if (stage.uses_gpu) {
+    glEndQuery(GL_TIME_ELAPSED);
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+    glDeleteQueries(1, &query);
+    sample.gpu_ms = elapsed_ns / 1e6;
+  }
+  if (texture) {
+    DeleteTexture(texture);
+  }
+  return sample;
+}
+
+double Median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const size_t middle = values.size() / 2;
+  if (values.size() % 2) {
+    return values[middle];
+  }
+  return 0.5 * (values[middle - 1] + values[middle]);
+}
+
+std::string JsonString(const std::string& value) {
+  std::string escaped = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+// Reads face 0 of |texture| as tightly packed RGB floats.
+std::vector<float> ReadFace(unsigned int texture, int size) {
+  std::vector<float> pixels(size * size * 3);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+  glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGB, GL_FLOAT,
+                pixels.data());
+  return pixels;
+}
+
+std::vector<Stage> MakeStages(unsigned int equirectangular_texture,
+                              unsigned int cubemap, int size,
+                              CompressionSpeed compression_speed,
+                              const std::vector<float>* face) {
+  std::vector<Stage> stages;
+  const int64_t face_texels = static_cast<int64_t>(size) * size;
+  const int64_t blocks_per_row = (size + 3) / 4;
+  const int64_t blocks = blocks_per_row * blocks_per_row;
+  const int irradiance_size = std::max(8, size / 16);
+  const int num_mips = 1 + static_cast<int>(std::floor(std::log2(size)));
+  int64_t prefilter_texels = 0;
+  for (int mip = 0; mip < num_mips; ++mip) {
+    const int64_t mip_size = std::max(1, size >> mip);
+    prefilter_texels += 6 * mip_size * mip_size;
+  }
+
+  stages.push_back({"equirectangular_to_cubemap", true, size, 6 * face_texels,
+                    0, [=]() {
+                      return ConvertEquirectangularTextureToCubemap(
+                          equirectangular_texture, size, size);
+                    }});
+  stages.push_back(
+      {"irradiance", true, irradiance_size,
+       6 * static_cast<int64_t>(irradiance_size) * irradiance_size, 0, [=]() {
+         return GenerateIrradianceMap(cubemap, irradiance_size,
+                                      irradiance_size);
+       }});
+  stages.push_back({"prefilter", true, size, prefilter_texels, 0, [=]() {
+                      return GeneratePreFilteredMap(cubemap, size, size);
+                    }});
+  stages.push_back({"brdf_lut", true, size, face_texels, 0, [=]() {
+                      return GenerateBRDFLookUpTable(size, size);
+                    }});
+  stages.push_back({"write_ktx", false, size, 6 * face_texels, 0, [=]() {
+                      WriteCubemapToKtx("bench_tmp", cubemap, size, size);
+                      std::remove("bench_tmp.ktx");
+                      return 0u;
+                    }});
+  stages.push_back({"encode_astc", false, size, face_texels, blocks, [=]() {
+                      uint8_t* data;
+                      size_t data_size;
+                      EncodeAstc(face->data(), size, size, GL_RGB, GL_FLOAT,
+                                 &data, &data_size, 4, 4, compression_speed);
+                      delete[] data;
+                      return 0u;
+                    }});
+  stages.push_back({"encode_bc6h", false, size, face_texels, blocks, [=]() {
+                      uint8_t* data;
+                      size_t data_size;
+                      EncodeBc6h(face->data(), size, size, GL_RGB, GL_FLOAT,
+                                 &data, &data_size, compression_speed);
+                      delete[] data;
+                      return 0u;
+                    }});
+  return stages;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<int> sizes = {64, 128, 256};
+  std::vector<std::string> input_files;
+  int repetitions = 3;
+  CompressionSpeed speed = CompressionSpeed::kFast;
+  std::string output;
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (ParseFlag(argv[i], "sizes", &value)) {
+      sizes = ParseIntList(value);
+    } else if (ParseFlag(argv[i], "inputs", &value)) {
+      input_files = ParseStringList(value);
+    } else if (ParseFlag(argv[i], "repetitions", &value)) {
+      repetitions = std::max(1, std::stoi(value));
+    } else if (ParseFlag(argv[i], "speed", &value)) {
+      if (!CompressionSpeedFromString(value, &speed)) {
+        std::cerr << "Unknown speed: " << value << std::endl;
+        return 1;
+      }
+    } else if (ParseFlag(argv[i], "output", &value)) {
+      output = value;
+    } else {
+      std::cerr << "Unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  suppress_progress_counter = 1;
+  GlContext context;
+  if (!CreateGlContext(true, &context)) {
+    return 1;
+  }
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+  std::vector<Input> inputs;
+  const std::vector<float> synthetic = MakeSyntheticEnvironment(1024, 512);
+  inputs.push_back(
+      {"synthetic", UploadEquirectangularTexture(synthetic.data(), 1024, 512,
+                                                 3)});
+  for (const std::string& file : input_files) {
+    const unsigned int texture =
+        LoadHDRTexture(file.c_str(), nullptr, nullptr);
+    if (!texture) {
+      std::cerr << "Skipping " << file << std::endl;
+      continue;
+    }
+    inputs.push_back({file, texture});
+  }
+
+  std::stringstream json;
+  json << "{\n  \"renderer\": "
+       << JsonString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)))
+       << ",\n  \"repetitions\": " << repetitions << ",\n  \"results\": [";
+  bool first = true;
+  for (const Input& input : inputs) {
+    for (int size : sizes) {
+      const unsigned int cubemap =
+          ConvertEquirectangularTextureToCubemap(input.texture, size, size);
+      const std::vector<float> face = ReadFace(cubemap, size);
+      for (const Stage& stage :
+           MakeStages(input.texture, cubemap, size, speed, &face)) {
+        // Warm up shader compilation and driver caches.
+        RunStage(stage);
+        std::vector<double> wall_ms;
+        std::vector<double> gpu_ms;
+        for (int i = 0; i < repetitions; ++i) {
+          const Sample sample = RunStage(stage);
+          wall_ms.push_back(sample.wall_ms);
+          gpu_ms.push_back(sample.gpu_ms);
+        }
+        const double median_ms = Median(wall_ms);
+        const double seconds = std::max(median_ms, 1e-6) / 1000.0;
+
+        json << (first ? "\n" : ",\n") << "    {\"stage\": "
+             << JsonString(stage.name)
+             << ", \"input\": " << JsonString(input.name)
+             << ", \"size\": " << stage.size
+             << ", \"wall_ms\": " << median_ms << ", \"wall_ms_min\": "
+             << *std::min_element(wall_ms.begin(), wall_ms.end());
+        if (stage.uses_gpu) {
+          json << ", \"gpu_ms\": " << Median(gpu_ms);
+        }
+        json << ", \"texels_per_second\": " << stage.texels / seconds;
+        if (stage.blocks) {
+          json << ", \"blocks_per_second\": " << stage.blocks / seconds;
+        }
+        json << ", \"peak_rss_kb\": " << GetPeakRssKb() << "}";
+        first = false;
+      }
+      DeleteTexture(cubemap);
+    }
+  }
+  json << "\n  ]\n}\n";
+
+  for (const Input& input : inputs) {
+    DeleteTexture(input.texture);
+  }
+  DestroyGlContext(&context);
+
+  if (output.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream file(output);
+    file << json.str();
+  }
+  return 0;
+}
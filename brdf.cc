@@ -0,0 +1,242 @@
+#include "brdf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "parallel.h"
+#include "trace.h"
+
+namespace {
+const float kPi = 3.14159265359f;
+
+float RadicalInverse(uint32_t bits) {
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return static_cast<float>(bits) * 2.3283064365386963e-10f;
+}
+
+float GeometrySchlickGGX(float n_dot_v, float k) {
+  return n_dot_v / (n_dot_v * (1.0f - k) + k);
+}
+
+// Fit of the Charlie sheen masking exponent by Estevez and Kulla.
+float SheenLambdaHelper(float x, float alpha) {
+  const float t = (1.0f - alpha) * (1.0f - alpha);
+  const float a = 21.5473f + (25.3245f - 21.5473f) * t;
+  const float b = 3.82987f + (3.32435f - 3.82987f) * t;
+  const float c = 0.19823f + (0.16801f - 0.19823f) * t;
+  const float d = -1.97760f + (-1.27393f + 1.97760f) * t;
+  const float e = -4.32054f + (-4.85967f + 4.32054f) * t;
+  return a / (1.0f + b * std::pow(x, c)) + d * x + e;
+}
+
+float SheenLambda(float cos_theta, float alpha) {
+  if (cos_theta < 0.5f) {
+    return std::exp(SheenLambdaHelper(cos_theta, alpha));
+  }
+  return std::exp(2.0f * SheenLambdaHelper(0.5f, alpha) -
+                  SheenLambdaHelper(1.0f - cos_theta, alpha));
+}
+
+// The GGX half vectors of a roughness, which all texels of a row share. One
+// array per component keeps the loop over them in IntegrateRow() free of
+// trigonometry and square roots. With N = +z the shader's tangent frame maps
+// the sample (x, y, z) to (y, -x, z); V has no y component, so only x and z
+// are needed.
+struct HalfVectors {
+  std::vector<float> x;
+  std::vector<float> z;
+};
+
+void SampleHalfVectors(float roughness, int num_samples, HalfVectors* out) {
+  const float a = roughness * roughness;
+  out->x.resize(num_samples);
+  out->z.resize(num_samples);
+  for (int i = 0; i < num_samples; ++i) {
+    const float xi_x = static_cast<float>(i) / static_cast<float>(num_samples);
+    const float xi_y = RadicalInverse(i);
+    const float phi = 2.0f * kPi * xi_x;
+    const float cos_theta =
+        std::sqrt((1.0f - xi_y) / (1.0f + (a * a - 1.0f) * xi_y));
+    const float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+    const float h_x = std::cos(phi) * sin_theta;
+    const float h_y = std::sin(phi) * sin_theta;
+    const float h_z = cos_theta;
+    const float length = std::sqrt(h_x * h_x + h_y * h_y + h_z * h_z);
+    out->x[i] = h_y / length;
+    out->z[i] = h_z / length;
+  }
+}
+
+// max(v, 0) without a comparison, which GCC won't if-convert under its
+// default -ftrapping-math. Exact, as doubling a float is.
+inline float ClampToZero(float v) { return 0.5f * (v + std::fabs(v)); }
+
+// Texels of a row integrated together. Fixed-size local arrays let GCC
+// vectorize the loop over them even under the cost model of -O2.
+const int kRowBlock = 8;
+
+// Each block sums the samples of its texels in order, so the results match
+// a loop over the samples of one texel. Samples below the horizon aren't
+// skipped but get N.L = 0, which makes G and their weight 0, so the loop has
+// no branches.
+void IntegrateRow(float roughness, const HalfVectors& h, int width,
+                  float* row) {
+  const int num_samples = static_cast<int>(h.x.size());
+  const float k = roughness * roughness / 2.0f;
+  for (int first = 0; first < width; first += kRowBlock) {
+    float v_x[kRowBlock];
+    float v_z[kRowBlock];
+    float g_v[kRowBlock];
+    float scale[kRowBlock] = {};
+    float bias[kRowBlock] = {};
+    for (int j = 0; j < kRowBlock; ++j) {
+      // Lanes past the end of the row repeat its last texel.
+      const float n_dot_v = (std::min(first + j, width - 1) + 0.5f) / width;
+      v_x[j] = std::sqrt(1.0f - n_dot_v * n_dot_v);
+      v_z[j] = n_dot_v;
+      g_v[j] = GeometrySchlickGGX(n_dot_v, k);
+    }
+    for (int i = 0; i < num_samples; ++i) {
+      const float h_x = h.x[i];
+      const float h_z = h.z[i];
+      const float n_dot_h = ClampToZero(h_z);
+      for (int j = 0; j < kRowBlock; ++j) {
+        const float v_dot_h = ClampToZero(v_x[j] * h_x + v_z[j] * h_z);
+        // L = reflect(-V, H) has unit length, so unlike the shader this
+        // doesn't normalize it.
+        const float n_dot_l = ClampToZero(2.0f * v_dot_h * h_z - v_z[j]);
+        const float g = GeometrySchlickGGX(n_dot_l, k) * g_v[j];
+        const float g_vis = (g * v_dot_h) / (n_dot_h * v_z[j]);
+        const float one_minus = 1.0f - v_dot_h;
+        const float squared = one_minus * one_minus;
+        const float fc = squared * squared * one_minus;
+        scale[j] += (1.0f - fc) * g_vis;
+        bias[j] += fc * g_vis;
+      }
+    }
+    for (int j = 0; j < kRowBlock && first + j < width; ++j) {
+      row[(first + j) * 2] = scale[j] / num_samples;
+      row[(first + j) * 2 + 1] = bias[j] / num_samples;
+    }
+  }
+}
+
+// Light directions spread uniformly over the hemisphere for the sheen lobes,
+// from the same sequence as the GGX half vectors, and the sheen masking
+// exponent of each for the roughness of the row.
+struct SheenSamples {
+  std::vector<float> x;
+  std::vector<float> z;
+  std::vector<float> lambda;
+};
+
+void SampleSheenLights(float roughness, int num_samples, SheenSamples* out) {
+  const float a = roughness * roughness;
+  out->x.resize(num_samples);
+  out->z.resize(num_samples);
+  out->lambda.resize(num_samples);
+  for (int i = 0; i < num_samples; ++i) {
+    const float xi_x = static_cast<float>(i) / static_cast<float>(num_samples);
+    const float cos_theta = 1.0f - RadicalInverse(i);
+    const float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+    out->x[i] = std::sin(2.0f * kPi * xi_x) * sin_theta;
+    out->z[i] = cos_theta;
+    out->lambda[i] = SheenLambda(cos_theta, a);
+  }
+}
+
+void IntegratePackRow(float roughness, const HalfVectors& h,
+                      const SheenSamples& l, int width, float* row) {
+  const int num_samples = static_cast<int>(h.x.size());
+  const float k = roughness * roughness / 2.0f;
+  const float alpha = roughness * roughness;
+  const float inv_alpha = 1.0f / alpha;
+  const float d_scale = (2.0f + inv_alpha) / (2.0f * kPi);
+  for (int x = 0; x < width; ++x) {
+    const float n_dot_v = (x + 0.5f) / width;
+    const float v_x = std::sqrt(1.0f - n_dot_v * n_dot_v);
+    const float v_z = n_dot_v;
+    const float g_v = GeometrySchlickGGX(n_dot_v, k);
+    const float lambda_v = SheenLambda(n_dot_v, alpha);
+    float scale = 0.0f;
+    float bias = 0.0f;
+    float sheen = 0.0f;
+    float sheen_albedo = 0.0f;
+    for (int i = 0; i < num_samples; ++i) {
+      const float v_dot_h = std::max(v_x * h.x[i] + v_z * h.z[i], 0.0f);
+      const float n_dot_l = 2.0f * v_dot_h * h.z[i] - v_z;
+      if (n_dot_l > 0.0f) {
+        const float n_dot_h = std::max(h.z[i], 0.0f);
+        const float g = GeometrySchlickGGX(n_dot_l, k) * g_v;
+        const float g_vis = (g * v_dot_h) / (n_dot_h * n_dot_v);
+        const float one_minus = 1.0f - v_dot_h;
+        const float squared = one_minus * one_minus;
+        const float fc = squared * squared * one_minus;
+        scale += (1.0f - fc) * g_vis;
+        bias += fc * g_vis;
+      }
+
+      // Charlie distribution of the half vector between V and the sheen
+      // sample, with |L + V|^2 = 2 + 2 V.L.
+      const float sheen_n_dot_l = l.z[i];
+      const float n_dot_h_squared =
+          (sheen_n_dot_l + v_z) * (sheen_n_dot_l + v_z) /
+          (2.0f + 2.0f * (v_x * l.x[i] + v_z * sheen_n_dot_l));
+      const float sin_squared = std::max(1.0f - n_dot_h_squared, 0.0f);
+      const float d = d_scale * std::pow(sin_squared, 0.5f * inv_alpha);
+      const float ashikhmin = 1.0f / (4.0f * (sheen_n_dot_l + n_dot_v -
+                                              sheen_n_dot_l * n_dot_v));
+      const float visibility =
+          1.0f / ((1.0f + lambda_v + l.lambda[i]) * 4.0f * n_dot_v *
+                  sheen_n_dot_l);
+      sheen += d * std::min(ashikhmin, 1.0f) * sheen_n_dot_l;
+      sheen_albedo += d * std::min(visibility, 1.0f) * sheen_n_dot_l;
+    }
+    // The sheen samples have a density of 1 / (2 pi). The masking fit
+    // overshoots at grazing angles of the smoothest sheen, where the albedo
+    // would exceed 1.
+    row[x * 4] = scale / num_samples;
+    row[x * 4 + 1] = bias / num_samples;
+    row[x * 4 + 2] = sheen * 2.0f * kPi / num_samples;
+    row[x * 4 + 3] = std::min(sheen_albedo * 2.0f * kPi / num_samples, 1.0f);
+  }
+}
+}  // namespace
+
+std::vector<float> IntegrateBrdfLookUpTable(int width, int height,
+                                            int num_samples,
+                                            int thread_count) {
+  TraceScope trace("stage", "IntegrateBrdfLookUpTable");
+  std::vector<float> pixels(width * height * 2);
+  ParallelFor(height,
+              [&](int y) {
+                const float roughness = (y + 0.5f) / height;
+                HalfVectors h;
+                SampleHalfVectors(roughness, num_samples, &h);
+                IntegrateRow(roughness, h, width, &pixels[y * width * 2]);
+              },
+              thread_count);
+  return pixels;
+}
+
+std::vector<float> IntegrateBrdfLutPack(int width, int height, int num_samples,
+                                        int thread_count) {
+  TraceScope trace("stage", "IntegrateBrdfLutPack");
+  std::vector<float> pixels(width * height * 4);
+  ParallelFor(height,
+              [&](int y) {
+                const float roughness = (y + 0.5f) / height;
+                HalfVectors h;
+                SheenSamples l;
+                SampleHalfVectors(roughness, num_samples, &h);
+                SampleSheenLights(roughness, num_samples, &l);
+                IntegratePackRow(roughness, h, l, width,
+                                 &pixels[y * width * 4]);
+              },
+              thread_count);
+  return pixels;
+}
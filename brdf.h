@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+// CPU version of data/brdf.glslf: the split-sum scale and bias of the
+// specular BRDF by NdotV along x and roughness along y, for builds and
+// machines without a GPU.
+
+// Samples per texel of data/brdf.glslf.
+const int kBrdfSamples = 1024;
+
+// Returns the RG lookup table with rows starting at the bottom, as rendered by
+// GenerateBRDFLookUpTable(). Rows are spread over |thread_count| threads, 0
+// for the default.
+std::vector<float> IntegrateBrdfLookUpTable(int width, int height,
+                                            int num_samples = kBrdfSamples,
+                                            int thread_count = 0);
+
+// Returns the RGBA lookup table of all lobes our shading integrates, laid out
+// as above and evaluated from the same samples in one pass:
+//   R, G: the split-sum scale and bias, as IntegrateBrdfLookUpTable(). The
+//         multi-scatter energy compensation derives from their sum, the
+//         single-scatter albedo E: specular *= 1 + F0 * (1 / E - 1).
+//   B:    the Charlie sheen term with Ashikhmin visibility, which scales the
+//         sheen color and the prefiltered radiance.
+//   A:    the directional albedo of the Charlie sheen lobe, which scales the
+//         layers below it by 1 - max(sheen color) * A.
+// The sheen roughness is the y coordinate like the specular one.
+std::vector<float> IntegrateBrdfLutPack(int width, int height,
+                                        int num_samples = kBrdfSamples,
+                                        int thread_count = 0);
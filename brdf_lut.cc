@@ -0,0 +1,73 @@
+// Writes the BRDF lookup table integrated on the CPU, without an OpenGL
+// context, e.g. as a build step or on machines without a GPU.
+//
+//   bazel run :brdf_lut -- --size=512 --output=$PWD/brdf.ktx
+//
+// --pack writes the RGBA table of IntegrateBrdfLutPack() instead.
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "brdf.h"
+#include "flags.h"
+#include "writers.h"
+
+namespace {
+// Returns true and sets |out| if all of |value| is a positive int.
+bool ParsePositiveInt(const std::string& value, int* out) {
+  char* end;
+  const long parsed = std::strtol(value.c_str(), &end, 10);
+  if (value.empty() || *end || parsed <= 0 || parsed > INT_MAX) {
+    return false;
+  }
+  *out = static_cast<int>(parsed);
+  return true;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int size = 512;
+  int num_samples = kBrdfSamples;
+  std::string output = "brdf.ktx";
+  bool pack = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (ParseFlag(argv[i], "size", &value)) {
+      if (!ParsePositiveInt(value, &size)) {
+        std::cout << "Invalid size: " << value << std::endl;
+        return 1;
+      }
+    } else if (ParseFlag(argv[i], "samples", &value)) {
+      if (!ParsePositiveInt(value, &num_samples)) {
+        std::cout << "Invalid sample count: " << value << std::endl;
+        return 1;
+      }
+    } else if (ParseFlag(argv[i], "output", &value)) {
+      output = value;
+    } else if (std::string(argv[i]) == "--pack") {
+      pack = true;
+    } else {
+      std::cout << "Unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  std::ofstream file(output.c_str(),
+                     std::ios::out | std::ios::trunc | std::ios::binary);
+  if (pack) {
+    const std::vector<float> pixels =
+        IntegrateBrdfLutPack(size, size, num_samples);
+    WriteBrdfPackToKtx(&file, pixels.data(), size, size);
+  } else {
+    const std::vector<float> pixels =
+        IntegrateBrdfLookUpTable(size, size, num_samples);
+    WriteBrdfToKtx(&file, pixels.data(), size, size);
+  }
+  file.close();
+  if (!file) {
+    std::cout << "Failed to write " << output << std::endl;
+    return 1;
+  }
+  return 0;
+}
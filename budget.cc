@@ -0,0 +1,381 @@
+#include "budget.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "brdf.h"
+#include "ibl.h"
+#include "memory.h"
+#include "trace.h"
+#include "writers.h"
+
+namespace {
+// The calibration renders are large enough that the fixed cost of a draw
+// doesn't dominate and small enough to take a fraction of a bake.
+const int kCalibrationSourceWidth = 256;
+const int kCalibrationCubemapSize = 64;
+const int kCalibrationIrradianceSize = 8;
+const int kCalibrationPrefilterSize = 32;
+const int kCalibrationPrefilterSamples = 64;
+const int kCalibrationBrdfSize = 64;
+// The pack takes all samples per texel on the CPU, so a few rows suffice.
+const int kCalibrationBrdfPackSize = 16;
+// Encoded without mips, so every block has the detail of a first mip.
+const int kCalibrationEncodeSize = 16;
+
+const double kPi = 3.14159265358979323846;
+
+// Times |fn| including the GPU work it issues.
+double TimeNs(const std::function<void()>& fn) {
+  glFinish();
+  const auto start = std::chrono::steady_clock::now();
+  fn();
+  glFinish();
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+int GetNumMips(int size) {
+  return 1 + static_cast<int>(std::floor(std::log2(size)));
+}
+
+int64_t GetNumTexels(int size, bool mipmapped) {
+  return GetTextureSize(size, size, 6, 1, mipmapped);
+}
+
+// Texels of GenerateOctahedralMap() for a prefilter map of |size|.
+int64_t GetNumOctahedralTexels(int size) {
+  int64_t num_texels = 0;
+  for (int mip = 0; mip < GetNumMips(size); ++mip) {
+    const int64_t level_size = std::max(1, (2 * size) >> mip);
+    num_texels += level_size * level_size;
+  }
+  return num_texels;
+}
+
+int64_t GetNumBlocks(int size, bool mipmapped) {
+  int64_t num_blocks = 0;
+  const int num_mips = mipmapped ? GetNumMips(size) : 1;
+  for (int mip = 0; mip < num_mips; ++mip) {
+    const int64_t blocks_per_row = (std::max(1, size >> mip) + 3) / 4;
+    num_blocks += 6 * blocks_per_row * blocks_per_row;
+  }
+  return num_blocks;
+}
+
+// Samples per texel of data/irradiance_convolution.glslf.
+int64_t GetIrradianceSamples(float sample_delta) {
+  return static_cast<int64_t>(std::ceil(2 * kPi / sample_delta) *
+                              std::ceil(0.5 * kPi / sample_delta));
+}
+
+bool IsAstc(CompressedFormat format) {
+  return format == CompressedFormat::kAstc ||
+         format == CompressedFormat::kAstcLdr ||
+         format == CompressedFormat::kAstcSrgb;
+}
+
+// A sky with a small, very bright sun over a textured ground, so the encoders
+// see a realistic dynamic range.
+std::vector<float> MakeCalibrationEnvironment(int width, int height) {
+  std::vector<float> pixels(width * height * 3);
+  for (int y = 0; y < height; ++y) {
+    const float v = (y + 0.5f) / height;
+    for (int x = 0; x < width; ++x) {
+      const float u = (x + 0.5f) / width;
+      float* pixel = &pixels[(y * width + x) * 3];
+      if (v > 0.5f) {
+        const float sun = std::hypot(u - 0.3f, v - 0.8f) < 0.02f ? 5000.0f : 0;
+        pixel[0] = 0.4f + sun;
+        pixel[1] = 0.6f + sun;
+        pixel[2] = 1.0f + v + sun;
+      } else {
+        const float checker = ((x / 4 + y / 4) % 2) ? 0.3f : 0.1f;
+        pixel[0] = checker;
+        pixel[1] = checker * 0.8f;
+        pixel[2] = checker * 0.5f;
+      }
+    }
+  }
+  return pixels;
+}
+
+// Fills |ns_per_block| with the encode cost of |format| on |cubemap|. For
+// ASTC the entries from |policy|'s min to max speed are measured with that
+// speed as the slowest, the others are copied from the nearest measured one.
+void CalibrateEncoder(CompressedFormat format, const AstcQualityPolicy& policy,
+                      unsigned int cubemap, double* ns_per_block) {
+  const int min_speed = IsAstc(format) ? static_cast<int>(policy.min_speed) : 0;
+  const int max_speed = IsAstc(format) ? static_cast<int>(policy.max_speed) : 0;
+  const int64_t num_blocks = GetNumBlocks(kCalibrationEncodeSize, false);
+  for (int speed = min_speed; speed <= max_speed; ++speed) {
+    AstcQualityPolicy speed_policy = policy;
+    speed_policy.max_speed = static_cast<CompressionSpeed>(speed);
+    std::ostringstream out;
+    ns_per_block[speed] =
+        TimeNs([&]() {
+          WriteCubemapToKtxCompressedAs(
+              format, &out, "calibration", cubemap, kCalibrationEncodeSize,
+              kCalibrationEncodeSize, 1, speed_policy, nullptr);
+        }) /
+        num_blocks;
+  }
+  for (int speed = 0; speed < kNumCompressionSpeeds; ++speed) {
+    ns_per_block[speed] = ns_per_block[std::min(
+        std::max(speed, min_speed), max_speed)];
+  }
+}
+
+// Runs every stage once at a tiny size, or for the prefilter map, whose
+// program variants depend on the size, at the calibration size, so the
+// timings don't include compiling their programs. Returns the time the
+// compiles of the irradiance and prefilter variants took per variant.
+double WarmUp(unsigned int equirectangular) {
+  const int num_variants = CountUncompiledVariants(
+      1, kDefaultIrradianceSampleDelta, kCalibrationPrefilterSize,
+      kCalibrationPrefilterSamples, SourceLayout::kCubemap);
+  const double compile_ns = TimeNs([]() {
+    CompileVariants(1, kDefaultIrradianceSampleDelta,
+                    kCalibrationPrefilterSize, kCalibrationPrefilterSamples,
+                    SourceLayout::kCubemap);
+  });
+
+  const unsigned int cubemap =
+      ConvertEquirectangularTextureToCubemap(equirectangular, 4, 4);
+  DeleteTexture(GenerateIrradianceMap(cubemap, 1, 1));
+  DeleteTexture(GeneratePreFilteredMap(cubemap, kCalibrationPrefilterSize,
+                                       kCalibrationPrefilterSize,
+                                       kCalibrationPrefilterSamples));
+  DeleteTexture(GenerateBRDFLookUpTable(4, 4));
+  DeleteTexture(GenerateOctahedralMap(cubemap, 8, 1));
+  DeleteTexture(cubemap);
+  return num_variants > 0 ? compile_ns / num_variants : 0;
+}
+
+std::string ToString(double value) {
+  std::ostringstream out;
+  out << value;
+  return out.str();
+}
+}  // namespace
+
+BakeCosts CalibrateBakeCosts(const BakeOptions& options) {
+  TraceScope trace("stage", "CalibrateBakeCosts");
+  BakeCosts costs;
+  const int width = kCalibrationSourceWidth;
+  const int height = kCalibrationSourceWidth / 2;
+  const std::vector<float> pixels = MakeCalibrationEnvironment(width, height);
+  const unsigned int equirectangular =
+      UploadEquirectangularTexture(pixels.data(), width, height, 3);
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  costs.compile_ns_per_variant = WarmUp(equirectangular);
+
+  unsigned int cubemap = 0;
+  costs.convert_ns_per_texel =
+      TimeNs([&]() {
+        cubemap = ConvertEquirectangularTextureToCubemap(
+            equirectangular, kCalibrationCubemapSize, kCalibrationCubemapSize);
+      }) /
+      GetNumTexels(kCalibrationCubemapSize, false);
+
+  unsigned int irradiance = 0;
+  costs.irradiance_ns_per_sample =
+      TimeNs([&]() {
+        irradiance = GenerateIrradianceMap(cubemap, kCalibrationIrradianceSize,
+                                           kCalibrationIrradianceSize);
+      }) /
+      (GetNumTexels(kCalibrationIrradianceSize, false) *
+       GetIrradianceSamples(kDefaultIrradianceSampleDelta));
+  DeleteTexture(irradiance);
+
+  unsigned int prefilter = 0;
+  costs.prefilter_ns_per_sample =
+      TimeNs([&]() {
+        prefilter = GeneratePreFilteredMap(cubemap, kCalibrationPrefilterSize,
+                                           kCalibrationPrefilterSize,
+                                           kCalibrationPrefilterSamples);
+      }) /
+      (GetNumTexels(kCalibrationPrefilterSize, true) *
+       kCalibrationPrefilterSamples);
+  DeleteTexture(prefilter);
+
+  unsigned int brdf = 0;
+  costs.brdf_ns_per_texel =
+      TimeNs([&]() {
+        if (options.cpu_brdf) {
+          const std::vector<float> pixels = IntegrateBrdfLookUpTable(
+              kCalibrationBrdfSize, kCalibrationBrdfSize);
+          brdf = UploadBrdfLookUpTable(pixels.data(), kCalibrationBrdfSize,
+                                       kCalibrationBrdfSize);
+        } else {
+          brdf = GenerateBRDFLookUpTable(kCalibrationBrdfSize,
+                                         kCalibrationBrdfSize);
+        }
+      }) /
+      (kCalibrationBrdfSize * kCalibrationBrdfSize);
+  DeleteTexture(brdf);
+  costs.brdf_pack_ns_per_texel =
+      TimeNs([]() {
+        IntegrateBrdfLutPack(kCalibrationBrdfPackSize,
+                             kCalibrationBrdfPackSize);
+      }) /
+      (kCalibrationBrdfPackSize * kCalibrationBrdfPackSize);
+
+  std::ostringstream out;
+  costs.write_ns_per_texel =
+      TimeNs([&]() {
+        WriteCubemapToKtx(&out, "calibration", cubemap,
+                          kCalibrationCubemapSize, kCalibrationCubemapSize, 1,
+                          options.ktx_format);
+      }) /
+      GetNumTexels(kCalibrationCubemapSize, false);
+  std::ostringstream octahedral_out;
+  costs.octahedral_ns_per_texel =
+      TimeNs([&]() {
+        const unsigned int octahedral =
+            GenerateOctahedralMap(cubemap, 2 * kCalibrationCubemapSize, 1);
+        WriteOctahedralToKtx(&octahedral_out, "calibration", octahedral,
+                             2 * kCalibrationCubemapSize, 1,
+                             options.ktx_format);
+        DeleteTexture(octahedral);
+      }) /
+      (4 * kCalibrationCubemapSize * kCalibrationCubemapSize);
+  std::vector<std::string> faces;
+  costs.preview_ns_per_texel =
+      TimeNs([&]() {
+        EncodeCubemapToPng(cubemap, kCalibrationCubemapSize,
+                           kCalibrationCubemapSize, 0, &faces);
+      }) /
+      GetNumTexels(kCalibrationCubemapSize, false);
+  DeleteTexture(cubemap);
+
+  if (options.compress) {
+    const unsigned int encode_cubemap = ConvertEquirectangularTextureToCubemap(
+        equirectangular, kCalibrationEncodeSize, kCalibrationEncodeSize);
+    CalibrateEncoder(options.irradiance_compression, options.astc_policy,
+                     encode_cubemap, costs.irradiance_ns_per_block);
+    CalibrateEncoder(options.prefilter_compression, options.astc_policy,
+                     encode_cubemap, costs.prefilter_ns_per_block);
+    DeleteTexture(encode_cubemap);
+  }
+  costs.irradiance_compression = options.irradiance_compression;
+  costs.prefilter_compression = options.prefilter_compression;
+  DeleteTexture(equirectangular);
+  return costs;
+}
+
+double EstimateBakeMs(const BakeOptions& options, const BakeCosts& costs,
+                      bool include_brdf, bool include_previews,
+                      bool include_brdf_pack) {
+  // Bakes that skip the cubemap neither convert nor write it.
+  const int64_t cubemap_texels =
+      options.skip_cubemap && !options.progressive
+          ? 0
+          : GetNumTexels(options.cubemap_size, false);
+  const int64_t irradiance_texels =
+      GetNumTexels(options.irradiance_size, false);
+  const int64_t prefilter_texels = GetNumTexels(options.prefilter_size, true);
+  double ns = costs.convert_ns_per_texel * cubemap_texels;
+  ns += costs.irradiance_ns_per_sample * irradiance_texels *
+        GetIrradianceSamples(options.irradiance_sample_delta);
+  ns += costs.prefilter_ns_per_sample * prefilter_texels *
+        options.prefilter_samples;
+  ns += costs.write_ns_per_texel *
+        (cubemap_texels + irradiance_texels + prefilter_texels);
+  // Variants of these settings that this thread hasn't compiled yet, or has
+  // evicted, are compiled during the bake.
+  ns += costs.compile_ns_per_variant *
+        CountUncompiledVariants(
+            options.irradiance_size, options.irradiance_sample_delta,
+            options.prefilter_size, options.prefilter_samples,
+            options.skip_cubemap && !options.progressive
+                ? SourceLayout::kEquirectangular
+                : SourceLayout::kCubemap);
+  if (options.octahedral) {
+    ns += costs.octahedral_ns_per_texel *
+          GetNumOctahedralTexels(options.prefilter_size);
+  }
+  if (include_previews) {
+    ns += costs.preview_ns_per_texel *
+          (cubemap_texels + irradiance_texels + prefilter_texels);
+  }
+  if (options.compress) {
+    const int speed = static_cast<int>(options.astc_policy.max_speed);
+    ns += costs.irradiance_ns_per_block[speed] *
+          GetNumBlocks(options.irradiance_size, false);
+    ns += costs.prefilter_ns_per_block[speed] *
+          GetNumBlocks(options.prefilter_size, true);
+  }
+  if (include_brdf && options.brdf_size > 0) {
+    // The lookup table preview is a single face.
+    const double preview_ns =
+        include_previews ? costs.preview_ns_per_texel : 0;
+    ns += (costs.brdf_ns_per_texel + preview_ns) * options.brdf_size *
+          options.brdf_size;
+  }
+  if (include_brdf_pack && options.brdf_size > 0 && options.brdf_pack) {
+    ns += costs.brdf_pack_ns_per_texel * options.brdf_size * options.brdf_size;
+  }
+  return ns / 1e6;
+}
+
+BakeOptions FitBakeBudget(const BakeOptions& options, const BakeCosts& costs,
+                          double budget_ms, bool include_brdf,
+                          bool include_previews, bool include_brdf_pack) {
+  BakeOptions fitted = options;
+  // Progressive bakes take the default sample counts.
+  fitted.progressive = false;
+  const auto fits = [&]() {
+    return EstimateBakeMs(fitted, costs, include_brdf, include_previews,
+                          include_brdf_pack) <= budget_ms;
+  };
+  // The slower ASTC presets only improve the blocks the faster ones left
+  // below the target PSNR, so they are given up first.
+  AstcQualityPolicy& policy = fitted.astc_policy;
+  while (!fits() && policy.max_speed > policy.min_speed) {
+    policy.max_speed =
+        static_cast<CompressionSpeed>(static_cast<int>(policy.max_speed) - 1);
+  }
+  while (!fits() && fitted.prefilter_samples > 256) {
+    fitted.prefilter_samples /= 2;
+  }
+  while (!fits() && fitted.irradiance_sample_delta < 0.1f) {
+    fitted.irradiance_sample_delta *= 2;
+  }
+  while (!fits() && fitted.prefilter_size > 128) {
+    fitted.prefilter_size /= 2;
+  }
+  while (!fits() && fitted.prefilter_samples > 64) {
+    fitted.prefilter_samples /= 2;
+  }
+  while (!fits() && fitted.irradiance_size > 16) {
+    fitted.irradiance_size /= 2;
+  }
+  while (!fits() && fitted.prefilter_size > 32) {
+    fitted.prefilter_size /= 2;
+  }
+  return fitted;
+}
+
+KtxMetadata GetBakeSettingsMetadata(const BakeOptions& options,
+                                    double budget_ms, double estimated_ms) {
+  return {
+      {"ibl.time_budget_ms", ToString(budget_ms)},
+      {"ibl.estimated_ms", ToString(estimated_ms)},
+      {"ibl.cubemap_size", ToString(options.cubemap_size)},
+      {"ibl.irradiance_size", ToString(options.irradiance_size)},
+      {"ibl.irradiance_sample_delta",
+       ToString(options.irradiance_sample_delta)},
+      {"ibl.prefilter_size", ToString(options.prefilter_size)},
+      {"ibl.prefilter_samples", ToString(options.prefilter_samples)},
+      {"ibl.astc_max_speed",
+       CompressionSpeedToString(options.astc_policy.max_speed)},
+  };
+}
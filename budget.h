@@ -0,0 +1,64 @@
+#pragma once
+
+#include "baker.h"
+
+// Fits a bake into a wall time budget: a short calibration measures what
+// sampling, encoding and reading back cost on the current context, and the
+// sample counts, sizes and ASTC speed are then lowered until the estimated
+// bake time fits.
+
+struct BakeCosts {
+  // Per cubemap texel of the equirectangular conversion.
+  double convert_ns_per_texel = 0;
+  // Per sample of a texel of the irradiance and prefilter maps.
+  double irradiance_ns_per_sample = 0;
+  double prefilter_ns_per_sample = 0;
+  // Per texel of the BRDF lookup table.
+  double brdf_ns_per_texel = 0;
+  // Per texel of the BRDF pack, which is always integrated on the CPU.
+  double brdf_pack_ns_per_texel = 0;
+  // Per texel read back and written to an uncompressed KTX file.
+  double write_ns_per_texel = 0;
+  // Per texel of the octahedral prefilter map rendered, read back and written.
+  double octahedral_ns_per_texel = 0;
+  // Per texel read back and encoded as a PNG preview.
+  double preview_ns_per_texel = 0;
+  // Per program variant compiled for the irradiance and prefilter maps, or
+  // loaded from the program cache. 0 if the calibration found all of its
+  // variants compiled already.
+  double compile_ns_per_variant = 0;
+  // Per 4x4 block of the irradiance and prefilter compression, by the slowest
+  // ASTC speed allowed. Formats other than ASTC have a single speed, stored
+  // for every entry.
+  double irradiance_ns_per_block[kNumCompressionSpeeds] = {};
+  double prefilter_ns_per_block[kNumCompressionSpeeds] = {};
+  // The compressed formats measured.
+  CompressedFormat irradiance_compression = CompressedFormat::kAstc;
+  CompressedFormat prefilter_compression = CompressedFormat::kAstc;
+};
+
+// Measures the costs for the compressed formats of |options| with small
+// renders and encodes of a synthetic environment. Takes well under a second
+// on a GPU; needs a current OpenGL context.
+BakeCosts CalibrateBakeCosts(const BakeOptions& options);
+
+// Returns the estimated wall time of baking with |options| once the source is
+// loaded. The BRDF lookup table and pack are only counted with |include_brdf|
+// and |include_brdf_pack|, as bakers reuse them, and the PNG previews of every
+// stage with |include_previews|. Compiles are counted for the program variants
+// the calling thread lacks.
+double EstimateBakeMs(const BakeOptions& options, const BakeCosts& costs,
+                      bool include_brdf, bool include_previews = false,
+                      bool include_brdf_pack = false);
+
+// Returns |options| with the ASTC speed, the sample counts and the prefilter
+// and irradiance sizes lowered, in that order, until the estimate fits
+// |budget_ms|, or as far as they go.
+BakeOptions FitBakeBudget(const BakeOptions& options, const BakeCosts& costs,
+                          double budget_ms, bool include_brdf,
+                          bool include_previews = false,
+                          bool include_brdf_pack = false);
+
+// Describes the settings FitBakeBudget() chooses, for the KTX metadata.
+KtxMetadata GetBakeSettingsMetadata(const BakeOptions& options,
+                                    double budget_ms, double estimated_ms);
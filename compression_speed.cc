@@ -0,0 +1,22 @@
+#include "compression_speed.h"
+
+namespace {
+const char* const kNames[kNumCompressionSpeeds] = {
+    "veryfast", "fast", "medium", "thorough", "exhaustive",
+};
+}  // namespace
+
+bool CompressionSpeedFromString(const std::string& name,
+                                CompressionSpeed* speed) {
+  for (int i = 0; i < kNumCompressionSpeeds; ++i) {
+    if (name == kNames[i]) {
+      *speed = static_cast<CompressionSpeed>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* CompressionSpeedToString(CompressionSpeed speed) {
+  return kNames[static_cast<int>(speed)];
+}
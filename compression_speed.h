@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+// Speed presets shared by the texture encoders. Slower presets search more of
+// the encoding space and produce higher quality blocks.
+enum class CompressionSpeed {
+  kVeryFast = 0,
+  kFast,
+  kMedium,
+  kThorough,
+  kExhaustive,
+};
+
+static const int kNumCompressionSpeeds = 5;
+
+// Names are "veryfast", "fast", "medium", "thorough" and "exhaustive".
+bool CompressionSpeedFromString(const std::string& name,
+                                CompressionSpeed* speed);
+const char* CompressionSpeedToString(CompressionSpeed speed);
@@ -0,0 +1,93 @@
+// Sends a bake job to a running bake_daemon and prints its reply. Returned KTX
+// files are written to the working directory.
+//
+//   bazel run //daemon:bake_client -- --socket=/tmp/ibl.sock
+//       --input=$PWD/probe.exr --prefilter_compression=bc6h
+//
+// All flags except --socket are passed on as the request, see protocol.h.
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "flags.h"
+#include "protocol.h"
+
+namespace {
+const size_t kMaxReplySize = 1u << 31;
+
+int Connect(const std::string& path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string socket_path;
+  std::string request;
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (ParseFlag(argv[i], "socket", &value)) {
+      socket_path = value;
+    } else {
+      request += std::string(argv[i]) + "\n";
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  const int fd = Connect(socket_path);
+  if (fd < 0) {
+    std::cout << "Failed to connect to " << socket_path << std::endl;
+    return 1;
+  }
+  std::string reply;
+  if (!WriteFrame(fd, request) || !ReadFrame(fd, kMaxReplySize, &reply)) {
+    std::cout << "Connection failed" << std::endl;
+    close(fd);
+    return 1;
+  }
+
+  bool ok = false;
+  for (const std::string& line : SplitLines(reply)) {
+    std::cout << line << std::endl;
+    if (line == "status=ok") {
+      ok = true;
+    }
+    std::string value;
+    if (!ParseFlag(("--" + line).c_str(), "blob", &value)) {
+      continue;
+    }
+    std::string name;
+    std::stringstream(value) >> name;
+    std::string blob;
+    if (!ReadFrame(fd, kMaxReplySize, &blob)) {
+      std::cout << "Connection failed" << std::endl;
+      ok = false;
+      break;
+    }
+    std::ofstream file((name + ".ktx").c_str(),
+                       std::ios::out | std::ios::trunc | std::ios::binary);
+    file.write(blob.data(), blob.size());
+  }
+  close(fd);
+  return ok ? 0 : 1;
+}
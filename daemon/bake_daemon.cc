@@ -0,0 +1,292 @@
+// Bakes jobs sent over a Unix domain socket. The OpenGL context, the compiled
+// shaders, the BRDF lookup table, the ASTC tables and block cache and the
+// encoder threads stay warm between jobs, so a rebake only pays for the work
+// that depends on its source. See protocol.h for the protocol.
+//
+//   bazel run //daemon:bake_daemon -- --socket=/tmp/ibl.sock --headless
+//
+// Jobs run one at a time in the order they arrive. Options given on the
+// command line are the defaults of every job.
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "baker.h"
+#include "flags.h"
+#include "gl_context.h"
+#include "memory.h"
+#include "program_cache.h"
+#include "protocol.h"
+
+// Defined by the ASTC encoder.
+extern int suppress_progress_counter;
+
+namespace {
+const size_t kMaxRequestSize = 1 << 20;
+
+struct Job {
+  BakeOptions options;
+  std::string input;
+  std::string output_dir;
+  bool quit = false;
+};
+
+bool ParseRequest(const std::string& request, const BakeOptions& defaults,
+                  Job* job, std::string* error) {
+  job->options = defaults;
+  for (const std::string& line : SplitLines(request)) {
+    std::string value;
+    if (line == "--quit") {
+      job->quit = true;
+    } else if (ParseFlag(line.c_str(), "input", &value)) {
+      job->input = value;
+    } else if (ParseFlag(line.c_str(), "output_dir", &value)) {
+      job->output_dir = value;
+    } else if (!ParseBakeOption(line, &job->options, error)) {
+      return false;
+    }
+  }
+  if (!job->quit && job->input.empty()) {
+    *error = "Missing --input";
+    return false;
+  }
+  return true;
+}
+
+// Bakes |job| and sends the reply. Returns false if the connection failed.
+bool RunJob(Baker* baker, const Job& job, int fd) {
+  baker->set_options(job.options);
+  std::unique_ptr<FileBakeSink> file_sink;
+  std::unique_ptr<InMemoryBakeSink> memory_sink;
+  BakeSink* sink;
+  if (!job.output_dir.empty()) {
+    file_sink.reset(new FileBakeSink(job.output_dir, false));
+    sink = file_sink.get();
+  } else {
+    memory_sink.reset(new InMemoryBakeSink());
+    sink = memory_sink.get();
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const bool ok = baker->BakeFile(job.input, sink);
+  const double bake_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::cout << job.input << (ok ? " baked in " : " failed after ") << bake_ms
+            << " ms" << std::endl;
+
+  std::stringstream reply;
+  if (!ok) {
+    reply << "status=error\nerror=Failed to bake " << job.input << "\n";
+  } else {
+    reply << "status=ok\n";
+  }
+  reply << "bake_ms=" << bake_ms << "\n";
+  if (!ok) {
+    return WriteFrame(fd, reply.str());
+  }
+  if (file_sink) {
+    for (const std::string& path : file_sink->paths()) {
+      reply << "file=" << path << "\n";
+    }
+    return WriteFrame(fd, reply.str());
+  }
+  for (const auto& entry : memory_sink->ktx_files()) {
+    reply << "blob=" << entry.first << " " << entry.second.size() << "\n";
+  }
+  if (!WriteFrame(fd, reply.str())) {
+    return false;
+  }
+  for (const auto& entry : memory_sink->ktx_files()) {
+    if (!WriteFrame(fd, entry.second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Serves the requests of one client until it disconnects. Returns false once
+// a client asked the daemon to quit.
+bool ServeClient(Baker* baker, const BakeOptions& defaults, int fd) {
+  std::string request;
+  while (ReadFrame(fd, kMaxRequestSize, &request)) {
+    Job job;
+    std::string error;
+    if (!ParseRequest(request, defaults, &job, &error)) {
+      if (!WriteFrame(fd, "status=error\nerror=" + error + "\n")) {
+        break;
+      }
+      continue;
+    }
+    if (job.quit) {
+      WriteFrame(fd, "status=ok\n");
+      return false;
+    }
+    const bool replied = RunJob(baker, job, fd);
+    ResetMemoryStages();
+    if (!replied) {
+      break;
+    }
+  }
+  return true;
+}
+
+// Bakes a tiny source once, so the shaders are compiled, the BRDF lookup table
+// is rendered and the encoders are initialized before the first job.
+void WarmUp(Baker* baker, const BakeOptions& defaults) {
+  BakeOptions options = defaults;
+  options.cubemap_size = 16;
+  options.irradiance_size = 8;
+  options.prefilter_size = 16;
+  baker->set_options(options);
+  InMemoryBakeSink sink;
+  baker->Bake(
+      [](std::vector<float>* pixels, int* width, int* height) {
+        *width = 32;
+        *height = 16;
+        pixels->assign(*width * *height * 3, 1.0f);
+        return true;
+      },
+      &sink);
+}
+
+// Removes the socket at |path|, if any. Fails rather than deleting anything
+// else, e.g. a file at a mistyped --socket path.
+bool RemoveSocket(const std::string& path) {
+  struct stat status;
+  if (lstat(path.c_str(), &status) != 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    std::cout << "Failed to check " << path << std::endl;
+    return false;
+  }
+  if (!S_ISSOCK(status.st_mode)) {
+    std::cout << path << " exists and is not a socket" << std::endl;
+    return false;
+  }
+  if (unlink(path.c_str()) != 0) {
+    std::cout << "Failed to remove " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int Listen(const std::string& path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cout << "Socket path too long: " << path << std::endl;
+    return -1;
+  }
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+  // A previous daemon may have left its socket behind.
+  if (!RemoveSocket(path)) {
+    return -1;
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cout << "Failed to create socket" << std::endl;
+    return -1;
+  }
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(fd, 8) != 0) {
+    std::cout << "Failed to listen on " << path << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  BakeOptions defaults;
+  std::string socket_path;
+  bool headless = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (std::string(argv[i]) == "--headless") {
+      headless = true;
+    } else if (ParseFlag(argv[i], "socket", &value)) {
+      socket_path = value;
+    } else if (ParseFlag(argv[i], "memory_budget_mb", &value)) {
+      if (!SetMemoryBudgetMb(value)) {
+        std::cout << "Invalid memory budget: " << value << std::endl;
+        return 1;
+      }
+    } else if (ParseFlag(argv[i], "program_cache", &value)) {
+      SetProgramCacheDirectory(value);
+    } else {
+      std::string error;
+      if (!ParseBakeOption(argv[i], &defaults, &error)) {
+        std::cout << error << std::endl;
+        return 1;
+      }
+    }
+  }
+  if (socket_path.empty()) {
+    std::cout << "Usage: bake_daemon --socket=<path> [options]" << std::endl;
+    return 1;
+  }
+
+  // Failed writes to clients that went away are handled as errors.
+  signal(SIGPIPE, SIG_IGN);
+  suppress_progress_counter = 1;
+
+  GlContext context;
+  if (!CreateGlContext(headless, &context)) {
+    return 1;
+  }
+  const int listen_fd = Listen(socket_path);
+  if (listen_fd < 0) {
+    DestroyGlContext(&context);
+    return 1;
+  }
+
+  {
+    Baker baker(defaults);
+    WarmUp(&baker, defaults);
+    ResetMemoryStages();
+    std::cout << "Listening on " << socket_path << std::endl;
+
+    bool running = true;
+    while (running) {
+      const int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        // Logging may change errno.
+        const int error = errno;
+        if (error == EINTR || error == ECONNABORTED) {
+          continue;
+        }
+        std::cout << "Failed to accept a client: " << strerror(error)
+                  << std::endl;
+        // Running out of descriptors or buffers may pass once other
+        // processes release theirs; anything else won't.
+        if (error == EMFILE || error == ENFILE || error == ENOBUFS ||
+            error == ENOMEM) {
+          std::this_thread::sleep_for(std::chrono::seconds(1));
+          continue;
+        }
+        break;
+      }
+      running = ServeClient(&baker, defaults, fd);
+      close(fd);
+    }
+  }
+
+  close(listen_fd);
+  RemoveSocket(socket_path);
+  DestroyGlContext(&context);
+  return 0;
+}
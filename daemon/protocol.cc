@@ -0,0 +1,74 @@
+#include "protocol.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cerrno>
+#include <cstdint>
+#include <sstream>
+
+namespace {
+bool ReadAll(int fd, char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = recv(fd, data, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = send(fd, data, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+}  // namespace
+
+bool ReadFrame(int fd, size_t max_size, std::string* frame) {
+  uint8_t header[4];
+  if (!ReadAll(fd, reinterpret_cast<char*>(header), sizeof(header))) {
+    return false;
+  }
+  const uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) |
+                        (static_cast<uint32_t>(header[3]) << 24);
+  if (size > max_size) {
+    return false;
+  }
+  frame->resize(size);
+  return size == 0 || ReadAll(fd, &(*frame)[0], size);
+}
+
+bool WriteFrame(int fd, const std::string& frame) {
+  const uint32_t size = static_cast<uint32_t>(frame.size());
+  const uint8_t header[4] = {
+      static_cast<uint8_t>(size), static_cast<uint8_t>(size >> 8),
+      static_cast<uint8_t>(size >> 16), static_cast<uint8_t>(size >> 24)};
+  return WriteAll(fd, reinterpret_cast<const char*>(header), sizeof(header)) &&
+         WriteAll(fd, frame.data(), frame.size());
+}
+
+std::vector<std::string> SplitLines(const std::string& text) {
+  std::vector<std::string> lines;
+  std::stringstream stream(text);
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (!line.empty()) {
+      lines.push_back(line);
+    }
+  }
+  return lines;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Framing of the bake daemon protocol. Every message is a frame: a 32-bit
+// little-endian length followed by that many bytes.
+//
+// A request is a single frame of newline separated flags, e.g.
+//
+//   --input=/probes/hall.exr
+//   --prefilter_compression=bc6h
+//   --output_dir=/probes/hall
+//
+// Any option of the tool is accepted. With --output_dir the KTX files are
+// written there, otherwise they are sent back. The request "--quit" stops the
+// daemon.
+//
+// The reply starts with a frame of newline separated "key=value" lines:
+// "status" is "ok" or "error", "error" the message of a failed bake and
+// "bake_ms" the time the bake took. Written files follow as "file=<path>"
+// lines. Returned files follow as "blob=<name> <size>" lines, each followed by
+// a frame with its contents after the first frame, in the same order.
+
+// Reads or writes a whole frame on the socket |fd|. Return false if the peer
+// closed the connection, on errors or if a frame is larger than |max_size|.
+// Processes should ignore SIGPIPE, so a closed connection is an error rather
+// than a signal.
+bool ReadFrame(int fd, size_t max_size, std::string* frame);
+bool WriteFrame(int fd, const std::string& frame);
+
+// Splits |text| at newlines and drops empty lines.
+std::vector<std::string> SplitLines(const std::string& text);
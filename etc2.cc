@@ -0,0 +1,388 @@
+#include "etc2.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "parallel.h"
+
+// Enums copied from GL/GL.h
+#define GL_RGBA 0x1908
+#define GL_UNSIGNED_BYTE 0x1401
+
+namespace {
+// ETC1 intensity modifiers. Selector 0 and 1 add the first and second value,
+// selector 2 and 3 subtract them.
+const int kColorModifiers[8][2] = {{2, 8},   {5, 17},  {9, 29},  {13, 42},
+                                   {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+
+const int kAlphaModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12}, {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},  {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},  {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},  {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},   {-3, -5, -7, -9, 2, 4, 6, 8}};
+
+struct SpeedParameters {
+  // Base colors are searched in a cube of this radius around the average.
+  int color_radius;
+  // Only search along the gray axis instead of the full cube.
+  bool luminance_only;
+  int alpha_multiplier_radius;
+  int alpha_base_radius;
+};
+
+SpeedParameters GetSpeedParameters(CompressionSpeed speed) {
+  switch (speed) {
+    case CompressionSpeed::kVeryFast:
+      return {0, true, 0, 0};
+    case CompressionSpeed::kFast:
+      return {1, true, 1, 1};
+    case CompressionSpeed::kMedium:
+      return {1, false, 1, 2};
+    case CompressionSpeed::kThorough:
+      return {1, false, 2, 4};
+    case CompressionSpeed::kExhaustive:
+      return {2, false, 4, 6};
+  }
+  assert(false);
+  return {0, true, 0, 0};
+}
+
+// Texels are indexed by y * 4 + x.
+struct Block {
+  int texels[16][4];
+};
+
+struct SubblockResult {
+  int color[3];  // Quantized.
+  int table;
+  int selectors[16];  // Only the texels of the subblock are written.
+  int64_t error;
+};
+
+int Clamp255(int value) { return std::min(255, std::max(0, value)); }
+
+int ExpandColor(int value, int bits) {
+  return bits == 4 ? (value << 4) | value : (value << 3) | (value >> 2);
+}
+
+bool InSubblock(int texel, bool flip, int subblock) {
+  const int x = texel & 3;
+  const int y = texel >> 2;
+  return ((flip ? y : x) >= 2) == (subblock == 1);
+}
+
+// Finds the best table and selectors for a fixed quantized base color.
+void EvaluateSubblock(const Block& block, bool flip, int subblock,
+                      const int color[3], int bits, SubblockResult* out) {
+  int base[3];
+  for (int c = 0; c < 3; ++c) {
+    base[c] = ExpandColor(color[c], bits);
+  }
+
+  out->error = std::numeric_limits<int64_t>::max();
+  for (int table = 0; table < 8; ++table) {
+    const int modifiers[4] = {kColorModifiers[table][0],
+                              kColorModifiers[table][1],
+                              -kColorModifiers[table][0],
+                              -kColorModifiers[table][1]};
+    int64_t table_error = 0;
+    int selectors[16];
+    for (int t = 0; t < 16 && table_error < out->error; ++t) {
+      if (!InSubblock(t, flip, subblock)) {
+        continue;
+      }
+      int64_t best_error = std::numeric_limits<int64_t>::max();
+      for (int s = 0; s < 4; ++s) {
+        int64_t error = 0;
+        for (int c = 0; c < 3; ++c) {
+          const int64_t diff =
+              Clamp255(base[c] + modifiers[s]) - block.texels[t][c];
+          error += diff * diff;
+        }
+        if (error < best_error) {
+          best_error = error;
+          selectors[t] = s;
+        }
+      }
+      table_error += best_error;
+    }
+    if (table_error < out->error) {
+      out->error = table_error;
+      out->table = table;
+      for (int t = 0; t < 16; ++t) {
+        if (InSubblock(t, flip, subblock)) {
+          out->selectors[t] = selectors[t];
+        }
+      }
+    }
+  }
+  for (int c = 0; c < 3; ++c) {
+    out->color[c] = color[c];
+  }
+}
+
+void AverageSubblock(const Block& block, bool flip, int subblock,
+                     float average[3]) {
+  average[0] = average[1] = average[2] = 0.0f;
+  for (int t = 0; t < 16; ++t) {
+    if (InSubblock(t, flip, subblock)) {
+      for (int c = 0; c < 3; ++c) {
+        average[c] += block.texels[t][c] / 8.0f;
+      }
+    }
+  }
+}
+
+// Searches base colors around |center|. If |constraint| is set, it is the color
+// of the other subblock and the second color must stay within [-4, 3] of the
+// first one.
+void SearchSubblock(const Block& block, bool flip, int subblock,
+                    const int center[3], int bits,
+                    const SpeedParameters& params, const int* constraint,
+                    SubblockResult* out) {
+  const int max_value = (1 << bits) - 1;
+  const int radius = params.color_radius;
+  const int min_delta = subblock == 1 ? -4 : -3;
+  const int max_delta = subblock == 1 ? 3 : 4;
+  out->error = std::numeric_limits<int64_t>::max();
+  for (int dr = -radius; dr <= radius; ++dr) {
+    for (int dg = -radius; dg <= radius; ++dg) {
+      for (int db = -radius; db <= radius; ++db) {
+        if (params.luminance_only && (dg != dr || db != dr)) {
+          continue;
+        }
+        const int offset[3] = {dr, dg, db};
+        int color[3];
+        bool valid = true;
+        for (int c = 0; c < 3; ++c) {
+          color[c] = center[c] + offset[c];
+          if (constraint) {
+            color[c] = std::min(constraint[c] + max_delta,
+                                std::max(constraint[c] + min_delta, color[c]));
+          }
+          valid = valid && color[c] >= 0 && color[c] <= max_value;
+        }
+        if (!valid) {
+          continue;
+        }
+        SubblockResult candidate;
+        EvaluateSubblock(block, flip, subblock, color, bits, &candidate);
+        if (candidate.error < out->error) {
+          *out = candidate;
+        }
+      }
+    }
+  }
+}
+
+void QuantizeAverage(const float average[3], int bits, int out[3]) {
+  const float scale = static_cast<float>((1 << bits) - 1) / 255.0f;
+  for (int c = 0; c < 3; ++c) {
+    out[c] = static_cast<int>(average[c] * scale + 0.5f);
+  }
+}
+
+uint64_t EncodeColorBlock(const Block& block, const SpeedParameters& params) {
+  int64_t best_error = std::numeric_limits<int64_t>::max();
+  uint64_t best_bits = 0;
+
+  for (int flip = 0; flip < 2; ++flip) {
+    float averages[2][3];
+    AverageSubblock(block, flip != 0, 0, averages[0]);
+    AverageSubblock(block, flip != 0, 1, averages[1]);
+
+    for (int differential = 0; differential < 2; ++differential) {
+      const int bits = differential ? 5 : 4;
+      int centers[2][3];
+      QuantizeAverage(averages[0], bits, centers[0]);
+      QuantizeAverage(averages[1], bits, centers[1]);
+
+      SubblockResult results[2];
+      if (!differential) {
+        SearchSubblock(block, flip != 0, 0, centers[0], bits, params, nullptr,
+                       &results[0]);
+        SearchSubblock(block, flip != 0, 1, centers[1], bits, params, nullptr,
+                       &results[1]);
+      } else {
+        // The second color is stored as a delta, so try fixing either side
+        // first and constrain the other one.
+        int64_t differential_error = std::numeric_limits<int64_t>::max();
+        for (int first = 0; first < 2; ++first) {
+          SubblockResult candidates[2];
+          SearchSubblock(block, flip != 0, first, centers[first], bits, params,
+                         nullptr, &candidates[first]);
+          SearchSubblock(block, flip != 0, 1 - first, centers[1 - first], bits,
+                         params, candidates[first].color,
+                         &candidates[1 - first]);
+          const int64_t error = candidates[0].error + candidates[1].error;
+          if (candidates[1].error < std::numeric_limits<int64_t>::max() &&
+              error < differential_error) {
+            differential_error = error;
+            results[0] = candidates[0];
+            results[1] = candidates[1];
+          }
+        }
+        if (differential_error == std::numeric_limits<int64_t>::max()) {
+          continue;
+        }
+      }
+
+      const int64_t error = results[0].error + results[1].error;
+      if (error >= best_error) {
+        continue;
+      }
+      best_error = error;
+
+      uint64_t bits_out = 0;
+      if (differential) {
+        for (int c = 0; c < 3; ++c) {
+          const uint64_t base = results[0].color[c];
+          const uint64_t delta = (results[1].color[c] - base) & 7;
+          bits_out |= base << (59 - 8 * c);
+          bits_out |= delta << (56 - 8 * c);
+        }
+        bits_out |= 1ull << 33;
+      } else {
+        for (int c = 0; c < 3; ++c) {
+          const uint64_t first = results[0].color[c];
+          const uint64_t second = results[1].color[c];
+          bits_out |= first << (60 - 8 * c);
+          bits_out |= second << (56 - 8 * c);
+        }
+      }
+      bits_out |= static_cast<uint64_t>(results[0].table) << 37;
+      bits_out |= static_cast<uint64_t>(results[1].table) << 34;
+      bits_out |= static_cast<uint64_t>(flip) << 32;
+
+      // Selectors are stored in column-major order.
+      for (int t = 0; t < 16; ++t) {
+        const int subblock = InSubblock(t, flip != 0, 1) ? 1 : 0;
+        const int selector = results[subblock].selectors[t];
+        const int index = (t & 3) * 4 + (t >> 2);
+        bits_out |= static_cast<uint64_t>(selector >> 1) << (16 + index);
+        bits_out |= static_cast<uint64_t>(selector & 1) << index;
+      }
+      best_bits = bits_out;
+    }
+  }
+  return best_bits;
+}
+
+uint64_t EncodeAlphaBlock(const Block& block, const SpeedParameters& params) {
+  int min_alpha = 255;
+  int max_alpha = 0;
+  for (int t = 0; t < 16; ++t) {
+    min_alpha = std::min(min_alpha, block.texels[t][3]);
+    max_alpha = std::max(max_alpha, block.texels[t][3]);
+  }
+
+  int64_t best_error = std::numeric_limits<int64_t>::max();
+  int best_base = 0;
+  int best_multiplier = 1;
+  int best_table = 0;
+  int best_indices[16] = {};
+
+  for (int table = 0; table < 16 && best_error > 0; ++table) {
+    const int* modifiers = kAlphaModifiers[table];
+    const int modifier_min = modifiers[3];
+    const int modifier_max = modifiers[7];
+    const int center_multiplier = std::min(
+        15, std::max(1, static_cast<int>(std::round(
+                            static_cast<float>(max_alpha - min_alpha) /
+                            (modifier_max - modifier_min)))));
+
+    for (int multiplier =
+             std::max(1, center_multiplier - params.alpha_multiplier_radius);
+         multiplier <=
+         std::min(15, center_multiplier + params.alpha_multiplier_radius);
+         ++multiplier) {
+      const int center_base = Clamp255(static_cast<int>(std::round(
+          0.5f * (min_alpha + max_alpha) -
+          0.5f * (modifier_min + modifier_max) * multiplier)));
+      for (int base = Clamp255(center_base - params.alpha_base_radius);
+           base <= Clamp255(center_base + params.alpha_base_radius); ++base) {
+        int64_t error = 0;
+        int indices[16];
+        for (int t = 0; t < 16 && error < best_error; ++t) {
+          int64_t best_texel_error = std::numeric_limits<int64_t>::max();
+          for (int i = 0; i < 8; ++i) {
+            const int64_t diff = Clamp255(base + modifiers[i] * multiplier) -
+                                 block.texels[t][3];
+            if (diff * diff < best_texel_error) {
+              best_texel_error = diff * diff;
+              indices[t] = i;
+            }
+          }
+          error += best_texel_error;
+        }
+        if (error < best_error) {
+          best_error = error;
+          best_base = base;
+          best_multiplier = multiplier;
+          best_table = table;
+          std::copy(indices, indices + 16, best_indices);
+        }
+      }
+    }
+  }
+
+  uint64_t bits = static_cast<uint64_t>(best_base) << 56;
+  bits |= static_cast<uint64_t>(best_multiplier) << 52;
+  bits |= static_cast<uint64_t>(best_table) << 48;
+  for (int t = 0; t < 16; ++t) {
+    const int index = (t & 3) * 4 + (t >> 2);
+    bits |= static_cast<uint64_t>(best_indices[t]) << (45 - 3 * index);
+  }
+  return bits;
+}
+
+void WriteBigEndian(uint64_t bits, uint8_t* out) {
+  for (int i = 0; i < 8; ++i) {
+    out[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  }
+}
+}  // namespace
+
+void EncodeEtc2Rgba(const void* pixels, int width, int height,
+                    uint32_t gl_format, uint32_t gl_type, uint8_t** out_data,
+                    size_t* out_size, CompressionSpeed compression_speed) {
+  assert(gl_format == GL_RGBA);
+  assert(gl_type == GL_UNSIGNED_BYTE);
+  (void)gl_format;
+  (void)gl_type;
+  const SpeedParameters params = GetSpeedParameters(compression_speed);
+  const uint8_t* rgba = static_cast<const uint8_t*>(pixels);
+
+  const int blocks_x = (width + 3) / 4;
+  const int blocks_y = (height + 3) / 4;
+  const size_t buffer_size = static_cast<size_t>(blocks_x) * blocks_y * 16;
+  uint8_t* buffer = new uint8_t[buffer_size];
+
+  ParallelFor(blocks_y, [&](int block_y) {
+    for (int block_x = 0; block_x < blocks_x; ++block_x) {
+      Block block;
+      for (int t = 0; t < 16; ++t) {
+        const int x = std::min(block_x * 4 + (t & 3), width - 1);
+        const int y = std::min(block_y * 4 + (t >> 2), height - 1);
+        const uint8_t* texel = rgba + (static_cast<size_t>(y) * width + x) * 4;
+        for (int c = 0; c < 4; ++c) {
+          block.texels[t][c] = texel[c];
+        }
+      }
+
+      uint8_t* out =
+          buffer + (static_cast<size_t>(block_y) * blocks_x + block_x) * 16;
+      WriteBigEndian(EncodeAlphaBlock(block, params), out);
+      WriteBigEndian(EncodeColorBlock(block, params), out + 8);
+    }
+  });
+
+  *out_data = buffer;
+  *out_size = buffer_size;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "compression_speed.h"
+
+// Encodes an RGBA8 image as GL_COMPRESSED_RGBA8_ETC2_EAC. Color blocks use the
+// ETC1 compatible individual and differential modes and alpha uses an EAC
+// block. |out_data| is allocated with new[] and holds 16 bytes per 4x4 block in
+// row-major block order.
+void EncodeEtc2Rgba(
+    const void* pixels, int width, int height, uint32_t gl_format,
+    uint32_t gl_type, uint8_t** out_data, size_t* out_size,
+    CompressionSpeed compression_speed = CompressionSpeed::kExhaustive);
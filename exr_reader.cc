@@ -0,0 +1,659 @@
+#include "exr_reader.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include "parallel.h"
+#include "pixel_formats.h"
+
+namespace {
+const int kCompressionNone = 0;
+const int kCompressionZips = 2;
+const int kCompressionZip = 3;
+const int kCompressionPiz = 4;
+
+const int kPixelTypeUint = 0;
+const int kPixelTypeHalf = 1;
+const int kPixelTypeFloat = 2;
+
+uint32_t ReadUint32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+int32_t ReadInt32(const uint8_t* data) {
+  return static_cast<int32_t>(ReadUint32(data));
+}
+
+uint64_t ReadUint64(const uint8_t* data) {
+  return ReadUint32(data) | (static_cast<uint64_t>(ReadUint32(data + 4)) << 32);
+}
+
+// Reads a null terminated string. Returns false if it runs past |end|.
+bool ReadString(const uint8_t** cursor, const uint8_t* end, std::string* out) {
+  const uint8_t* terminator =
+      static_cast<const uint8_t*>(memchr(*cursor, 0, end - *cursor));
+  if (!terminator) {
+    return false;
+  }
+  out->assign(reinterpret_cast<const char*>(*cursor), terminator - *cursor);
+  *cursor = terminator + 1;
+  return true;
+}
+
+// ZIP compresses blocks with zlib after a delta predictor and after splitting
+// the bytes into even and odd halves.
+bool ZipUncompress(const uint8_t* data, size_t size, uint8_t* out,
+                   size_t out_size) {
+  std::vector<uint8_t> tmp(out_size);
+  uLongf length = static_cast<uLongf>(out_size);
+  if (uncompress(tmp.data(), &length, data, static_cast<uLong>(size)) !=
+          Z_OK ||
+      length != out_size) {
+    return false;
+  }
+  for (size_t i = 1; i < out_size; ++i) {
+    tmp[i] = static_cast<uint8_t>(tmp[i - 1] + tmp[i] - 128);
+  }
+  const uint8_t* even = tmp.data();
+  const uint8_t* odd = tmp.data() + (out_size + 1) / 2;
+  for (size_t i = 0; i < out_size; ++i) {
+    out[i] = (i & 1) ? *odd++ : *even++;
+  }
+  return true;
+}
+
+// PIZ stores a Huffman coded, wavelet transformed and range reduced version of
+// the 16 bit values of each channel. The decoding below follows the reference
+// implementation in OpenEXR's ImfPizCompressor.cpp and ImfHuf.cpp.
+const int kHufEncodingSize = (1 << 16) + 1;
+const int kHufMaxCodeLength = 58;
+const int kHufShortZeroCodeRun = 59;
+const int kHufLongZeroCodeRun = 63;
+const int kHufShortestLongRun = 2 + kHufLongZeroCodeRun - kHufShortZeroCodeRun;
+
+// Reads bits most significant first.
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, const uint8_t* end)
+      : data_(data), end_(end), bits_(0), num_bits_(0) {}
+
+  bool Read(int count, uint32_t* out) {
+    while (num_bits_ < count) {
+      if (data_ == end_) {
+        return false;
+      }
+      bits_ = (bits_ << 8) | *data_++;
+      num_bits_ += 8;
+    }
+    num_bits_ -= count;
+    *out = static_cast<uint32_t>(bits_ >> num_bits_) & ((1u << count) - 1);
+    return true;
+  }
+
+  // Position after the last byte that was read from.
+  const uint8_t* position() const { return data_; }
+
+ private:
+  const uint8_t* data_;
+  const uint8_t* end_;
+  uint64_t bits_;
+  int num_bits_;
+};
+
+bool HufUncompress(const uint8_t* data, size_t size, uint16_t* out,
+                   size_t out_count) {
+  if (size == 0) {
+    return out_count == 0;
+  }
+  if (size < 20) {
+    return false;
+  }
+  uint32_t min_symbol = ReadUint32(data);
+  const uint32_t max_symbol = ReadUint32(data + 4);
+  const uint32_t num_bits = ReadUint32(data + 12);
+  if (min_symbol >= kHufEncodingSize || max_symbol >= kHufEncodingSize) {
+    return false;
+  }
+
+  // Code lengths are stored in 6 bits with runs of zeros compressed.
+  std::vector<uint8_t> lengths(kHufEncodingSize, 0);
+  BitReader table(data + 20, data + size);
+  for (uint32_t symbol = min_symbol; symbol <= max_symbol; ++symbol) {
+    uint32_t length;
+    if (!table.Read(6, &length)) {
+      return false;
+    }
+    uint32_t zero_run = 0;
+    if (length == kHufLongZeroCodeRun) {
+      if (!table.Read(8, &zero_run)) {
+        return false;
+      }
+      zero_run += kHufShortestLongRun;
+    } else if (length >= kHufShortZeroCodeRun) {
+      zero_run = length - kHufShortZeroCodeRun + 2;
+    }
+    if (zero_run) {
+      if (symbol + zero_run > max_symbol + 1) {
+        return false;
+      }
+      symbol += zero_run - 1;
+    } else {
+      lengths[symbol] = static_cast<uint8_t>(length);
+    }
+  }
+
+  // Canonical codes. Codes of one length are consecutive in symbol order and
+  // longer codes get the smaller values.
+  uint64_t counts[kHufMaxCodeLength + 1] = {};
+  for (int symbol = 0; symbol < kHufEncodingSize; ++symbol) {
+    ++counts[lengths[symbol]];
+  }
+  uint64_t first_codes[kHufMaxCodeLength + 1] = {};
+  uint64_t code = 0;
+  for (int length = kHufMaxCodeLength; length > 0; --length) {
+    first_codes[length] = code;
+    code = (code + counts[length]) >> 1;
+  }
+  size_t first_symbols[kHufMaxCodeLength + 2] = {};
+  for (int length = 1; length <= kHufMaxCodeLength; ++length) {
+    first_symbols[length + 1] = first_symbols[length] + counts[length];
+  }
+  std::vector<uint32_t> symbols(first_symbols[kHufMaxCodeLength + 1]);
+  {
+    size_t next[kHufMaxCodeLength + 1];
+    std::copy(first_symbols, first_symbols + kHufMaxCodeLength + 1, next);
+    for (int symbol = 0; symbol < kHufEncodingSize; ++symbol) {
+      if (lengths[symbol]) {
+        symbols[next[lengths[symbol]]++] = symbol;
+      }
+    }
+  }
+
+  const uint8_t* bits = table.position();
+  if (num_bits > (data + size - bits) * 8) {
+    return false;
+  }
+  BitReader reader(bits, data + size);
+  uint64_t bits_left = num_bits;
+  size_t count = 0;
+  while (count < out_count) {
+    code = 0;
+    int length = 0;
+    uint32_t symbol = 0;
+    bool found = false;
+    while (!found) {
+      uint32_t bit;
+      if (bits_left == 0 || length == kHufMaxCodeLength ||
+          !reader.Read(1, &bit)) {
+        return false;
+      }
+      --bits_left;
+      code = (code << 1) | bit;
+      ++length;
+      if (code >= first_codes[length] &&
+          code - first_codes[length] < counts[length]) {
+        symbol = symbols[first_symbols[length] + code - first_codes[length]];
+        found = true;
+      }
+    }
+
+    // The largest symbol repeats the previous value.
+    if (symbol == max_symbol) {
+      uint32_t repeat;
+      if (bits_left < 8 || !reader.Read(8, &repeat) || count == 0 ||
+          count + repeat > out_count) {
+        return false;
+      }
+      bits_left -= 8;
+      std::fill(out + count, out + count + repeat, out[count - 1]);
+      count += repeat;
+    } else {
+      out[count++] = static_cast<uint16_t>(symbol);
+    }
+  }
+  return true;
+}
+
+void Wavelet14Decode(uint16_t l, uint16_t h, uint16_t* a, uint16_t* b) {
+  const int16_t ls = static_cast<int16_t>(l);
+  const int hi = static_cast<int16_t>(h);
+  const int ai = ls + (hi & 1) + (hi >> 1);
+  *a = static_cast<uint16_t>(static_cast<int16_t>(ai));
+  *b = static_cast<uint16_t>(static_cast<int16_t>(ai - hi));
+}
+
+void Wavelet16Decode(uint16_t l, uint16_t h, uint16_t* a, uint16_t* b) {
+  const int kOffset = 1 << 15;
+  const int kMask = (1 << 16) - 1;
+  const int m = l;
+  const int d = h;
+  const int bb = (m - (d >> 1)) & kMask;
+  const int aa = (d + bb - kOffset) & kMask;
+  *b = static_cast<uint16_t>(bb);
+  *a = static_cast<uint16_t>(aa);
+}
+
+// Inverse of the 2D Haar-like wavelet of |nx| x |ny| values |ox| apart in x and
+// |oy| apart in y.
+void Wavelet2Decode(uint16_t* in, int nx, int ox, int ny, int oy,
+                    uint16_t max_value) {
+  const auto decode =
+      max_value < (1 << 14) ? Wavelet14Decode : Wavelet16Decode;
+  const int n = std::min(nx, ny);
+  int p = 1;
+  while (p <= n) {
+    p <<= 1;
+  }
+  p >>= 1;
+  int p2 = p;
+  p >>= 1;
+
+  while (p >= 1) {
+    uint16_t* py = in;
+    uint16_t* ey = in + oy * (ny - p2);
+    const int oy1 = oy * p;
+    const int oy2 = oy * p2;
+    const int ox1 = ox * p;
+    const int ox2 = ox * p2;
+    uint16_t i00, i01, i10, i11;
+
+    for (; py <= ey; py += oy2) {
+      uint16_t* px = py;
+      uint16_t* ex = py + ox * (nx - p2);
+      for (; px <= ex; px += ox2) {
+        uint16_t* p01 = px + ox1;
+        uint16_t* p10 = px + oy1;
+        uint16_t* p11 = p10 + ox1;
+        decode(*px, *p10, &i00, &i10);
+        decode(*p01, *p11, &i01, &i11);
+        decode(i00, i01, px, p01);
+        decode(i10, i11, p10, p11);
+      }
+      if (nx & p) {
+        uint16_t* p10 = px + oy1;
+        decode(*px, *p10, &i00, p10);
+        *px = i00;
+      }
+    }
+    if (ny & p) {
+      uint16_t* px = py;
+      uint16_t* ex = py + ox * (nx - p2);
+      for (; px <= ex; px += ox2) {
+        uint16_t* p01 = px + ox1;
+        decode(*px, *p01, &i00, p01);
+        *px = i00;
+      }
+    }
+    p2 = p;
+    p >>= 1;
+  }
+}
+
+// |channel_sizes| are the sizes of the channels' values in 16 bit units.
+bool PizUncompress(const uint8_t* data, size_t size, int nx, int ny,
+                   const std::vector<int>& channel_sizes, uint8_t* out,
+                   size_t out_size) {
+  static const int kBitmapSize = 8192;
+  if (size < 4) {
+    return false;
+  }
+  const uint16_t min_non_zero = data[0] | (data[1] << 8);
+  const uint16_t max_non_zero = data[2] | (data[3] << 8);
+  const uint8_t* cursor = data + 4;
+  const uint8_t* end = data + size;
+  if (max_non_zero >= kBitmapSize) {
+    return false;
+  }
+  std::vector<uint8_t> bitmap(kBitmapSize, 0);
+  if (min_non_zero <= max_non_zero) {
+    const size_t length = max_non_zero - min_non_zero + 1;
+    if (static_cast<size_t>(end - cursor) < length) {
+      return false;
+    }
+    memcpy(&bitmap[min_non_zero], cursor, length);
+    cursor += length;
+  }
+
+  // Values were mapped to their index among the values that occur.
+  std::vector<uint16_t> lut(1 << 16, 0);
+  int num_values = 0;
+  for (int i = 0; i < (1 << 16); ++i) {
+    if (i == 0 || (bitmap[i >> 3] & (1 << (i & 7)))) {
+      lut[num_values++] = static_cast<uint16_t>(i);
+    }
+  }
+  const uint16_t max_value = static_cast<uint16_t>(num_values - 1);
+
+  if (end - cursor < 4) {
+    return false;
+  }
+  const uint32_t length = ReadUint32(cursor);
+  cursor += 4;
+  if (length > static_cast<size_t>(end - cursor)) {
+    return false;
+  }
+  std::vector<uint16_t> tmp(out_size / 2);
+  if (!HufUncompress(cursor, length, tmp.data(), tmp.size())) {
+    return false;
+  }
+
+  std::vector<uint16_t*> channel_starts;
+  uint16_t* start = tmp.data();
+  for (int channel_size : channel_sizes) {
+    channel_starts.push_back(start);
+    for (int j = 0; j < channel_size; ++j) {
+      Wavelet2Decode(start + j, nx, channel_size, ny, nx * channel_size,
+                     max_value);
+    }
+    start += nx * ny * channel_size;
+  }
+  for (uint16_t& value : tmp) {
+    value = lut[value];
+  }
+
+  // Channels are stored one after the other but pixels interleave them per
+  // line.
+  uint8_t* dst = out;
+  for (int y = 0; y < ny; ++y) {
+    for (size_t c = 0; c < channel_sizes.size(); ++c) {
+      const size_t line_size = nx * channel_sizes[c];
+      for (size_t i = 0; i < line_size; ++i) {
+        dst[0] = static_cast<uint8_t>(channel_starts[c][i]);
+        dst[1] = static_cast<uint8_t>(channel_starts[c][i] >> 8);
+        dst += 2;
+      }
+      channel_starts[c] += line_size;
+    }
+  }
+  return true;
+}
+
+uint16_t ToHalf(const uint8_t* value, int pixel_type) {
+  switch (pixel_type) {
+    case kPixelTypeHalf:
+      return static_cast<uint16_t>(value[0] | (value[1] << 8));
+    case kPixelTypeFloat: {
+      const uint32_t bits = ReadUint32(value);
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      return FloatToHalf(f);
+    }
+    default:
+      return FloatToHalf(static_cast<float>(ReadUint32(value)));
+  }
+}
+}  // namespace
+
+ExrFile::ExrFile()
+    : width_(0),
+      height_(0),
+      min_x_(0),
+      min_y_(0),
+      compression_(kCompressionNone),
+      rgb_channels_{-1, -1, -1},
+      tiled_(false),
+      tile_width_(0),
+      tile_height_(0),
+      lines_per_chunk_(1) {}
+
+bool ExrFile::Open(const char* file) {
+  if (!file_.Open(file) || file_.size() < 8) {
+    return false;
+  }
+  const uint8_t* data = file_.data();
+  const uint8_t* end = data + file_.size();
+  const uint32_t version = ReadUint32(data + 4);
+  if (ReadUint32(data) != 20000630 || (version & 0xFF) != 2) {
+    return false;
+  }
+  // Deep data and multi-part files aren't supported.
+  if (version & 0x1800) {
+    return false;
+  }
+  tiled_ = (version & 0x200) != 0;
+
+  const uint8_t* cursor = data + 8;
+  if (!ReadHeader(&cursor, end)) {
+    return false;
+  }
+
+  int num_chunks;
+  if (tiled_) {
+    num_chunks = ((width_ + tile_width_ - 1) / tile_width_) *
+                 ((height_ + tile_height_ - 1) / tile_height_);
+  } else {
+    num_chunks = (height_ + lines_per_chunk_ - 1) / lines_per_chunk_;
+  }
+  if (static_cast<size_t>(end - cursor) < 8 * static_cast<size_t>(num_chunks)) {
+    return false;
+  }
+  chunk_offsets_.resize(num_chunks);
+  for (int i = 0; i < num_chunks; ++i) {
+    chunk_offsets_[i] = ReadUint64(cursor + 8 * i);
+    if (chunk_offsets_[i] >= file_.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ExrFile::ReadHeader(const uint8_t** cursor, const uint8_t* end) {
+  bool has_data_window = false;
+  while (true) {
+    std::string name;
+    std::string type;
+    if (!ReadString(cursor, end, &name)) {
+      return false;
+    }
+    if (name.empty()) {
+      break;
+    }
+    if (!ReadString(cursor, end, &type) || end - *cursor < 4) {
+      return false;
+    }
+    const uint32_t size = ReadUint32(*cursor);
+    *cursor += 4;
+    if (static_cast<size_t>(end - *cursor) < size) {
+      return false;
+    }
+    const uint8_t* value = *cursor;
+    const uint8_t* value_end = value + size;
+    *cursor += size;
+
+    if (name == "channels" && type == "chlist") {
+      while (value < value_end && *value) {
+        Channel channel;
+        if (!ReadString(&value, value_end, &channel.name) ||
+            value_end - value < 16) {
+          return false;
+        }
+        channel.pixel_type = ReadInt32(value);
+        channel.size = channel.pixel_type == kPixelTypeHalf ? 2 : 4;
+        const int32_t x_sampling = ReadInt32(value + 8);
+        const int32_t y_sampling = ReadInt32(value + 12);
+        if (channel.pixel_type < kPixelTypeUint ||
+            channel.pixel_type > kPixelTypeFloat || x_sampling != 1 ||
+            y_sampling != 1) {
+          return false;
+        }
+        value += 16;
+        channels_.push_back(channel);
+      }
+    } else if (name == "compression" && size == 1) {
+      compression_ = value[0];
+    } else if (name == "dataWindow" && size == 16) {
+      min_x_ = ReadInt32(value);
+      min_y_ = ReadInt32(value + 4);
+      width_ = ReadInt32(value + 8) - min_x_ + 1;
+      height_ = ReadInt32(value + 12) - min_y_ + 1;
+      has_data_window = true;
+    } else if (name == "tiles" && size == 9) {
+      tile_width_ = static_cast<int>(ReadUint32(value));
+      tile_height_ = static_cast<int>(ReadUint32(value + 4));
+    }
+  }
+
+  switch (compression_) {
+    case kCompressionNone:
+    case kCompressionZips:
+      lines_per_chunk_ = 1;
+      break;
+    case kCompressionZip:
+      lines_per_chunk_ = 16;
+      break;
+    case kCompressionPiz:
+      lines_per_chunk_ = 32;
+      break;
+    default:
+      return false;
+  }
+  if (!has_data_window || width_ <= 0 || height_ <= 0 ||
+      (tiled_ && (tile_width_ <= 0 || tile_height_ <= 0))) {
+    return false;
+  }
+
+  for (size_t i = 0; i < channels_.size(); ++i) {
+    const std::string& name = channels_[i].name;
+    if (name == "R" || name == "r") {
+      rgb_channels_[0] = static_cast<int>(i);
+    } else if (name == "G" || name == "g") {
+      rgb_channels_[1] = static_cast<int>(i);
+    } else if (name == "B" || name == "b") {
+      rgb_channels_[2] = static_cast<int>(i);
+    } else if (name == "Y" && rgb_channels_[0] < 0) {
+      rgb_channels_[0] = rgb_channels_[1] = rgb_channels_[2] =
+          static_cast<int>(i);
+    }
+  }
+  return rgb_channels_[0] >= 0 && rgb_channels_[1] >= 0 &&
+         rgb_channels_[2] >= 0;
+}
+
+bool ExrFile::DecodeToHalf(uint16_t* out_rgb, bool flip_vertically,
+                           int thread_count) const {
+  return DecodeChunks(0, static_cast<int>(chunk_offsets_.size()), 0, height_,
+                      out_rgb, flip_vertically, thread_count);
+}
+
+bool ExrFile::DecodeRowsToHalf(int first_row, int num_rows, uint16_t* out_rgb,
+                               int thread_count) const {
+  const int rows = chunk_rows();
+  if (first_row < 0 || num_rows <= 0 || first_row % rows != 0 ||
+      (num_rows % rows != 0 && first_row + num_rows != height_) ||
+      first_row + num_rows > height_) {
+    return false;
+  }
+  const int chunks_per_row =
+      tiled_ ? (width_ + tile_width_ - 1) / tile_width_ : 1;
+  const int begin = first_row / rows * chunks_per_row;
+  const int end = (first_row + num_rows + rows - 1) / rows * chunks_per_row;
+  return DecodeChunks(begin, end, first_row, num_rows, out_rgb, false,
+                      thread_count);
+}
+
+bool ExrFile::DecodeChunks(int begin, int end, int first_row, int num_rows,
+                           uint16_t* out_rgb, bool flip_vertically,
+                           int thread_count) const {
+  std::atomic<bool> failed(false);
+  ParallelFor(end - begin,
+              [&](int i) {
+                if (!DecodeChunk(begin + i, first_row, num_rows, out_rgb,
+                                 flip_vertically)) {
+                  failed = true;
+                }
+              },
+              thread_count);
+  return !failed;
+}
+
+bool ExrFile::DecodeChunk(int index, int first_row, int num_rows,
+                          uint16_t* out_rgb, bool flip_vertically) const {
+  const uint8_t* end = file_.data() + file_.size();
+  const uint8_t* chunk = file_.data() + chunk_offsets_[index];
+  int x0 = 0;
+  int y0;
+  int nx = width_;
+  int ny;
+  if (tiled_) {
+    if (end - chunk < 20) {
+      return false;
+    }
+    const int tile_x = ReadInt32(chunk);
+    const int tile_y = ReadInt32(chunk + 4);
+    // Only the tiles of the full resolution level are indexed.
+    if (ReadInt32(chunk + 8) != 0 || ReadInt32(chunk + 12) != 0) {
+      return false;
+    }
+    x0 = tile_x * tile_width_;
+    y0 = tile_y * tile_height_;
+    nx = std::min(tile_width_, width_ - x0);
+    ny = std::min(tile_height_, height_ - y0);
+    chunk += 16;
+  } else {
+    if (end - chunk < 8) {
+      return false;
+    }
+    y0 = ReadInt32(chunk) - min_y_;
+    ny = std::min(lines_per_chunk_, height_ - y0);
+    chunk += 4;
+  }
+  if (x0 < 0 || y0 < first_row || y0 + ny > first_row + num_rows || nx <= 0 ||
+      ny <= 0) {
+    return false;
+  }
+  const uint32_t data_size = ReadUint32(chunk);
+  const uint8_t* data = chunk + 4;
+  if (static_cast<size_t>(end - data) < data_size) {
+    return false;
+  }
+
+  size_t pixel_size = 0;
+  for (const Channel& channel : channels_) {
+    pixel_size += channel.size;
+  }
+  const size_t raw_size = pixel_size * nx * ny;
+  std::vector<uint8_t> raw;
+  // Chunks that don't get smaller are stored uncompressed.
+  if (data_size != raw_size) {
+    raw.resize(raw_size);
+    bool ok = false;
+    if (compression_ == kCompressionZip || compression_ == kCompressionZips) {
+      ok = ZipUncompress(data, data_size, raw.data(), raw_size);
+    } else if (compression_ == kCompressionPiz) {
+      std::vector<int> channel_sizes;
+      for (const Channel& channel : channels_) {
+        channel_sizes.push_back(channel.size / 2);
+      }
+      ok = PizUncompress(data, data_size, nx, ny, channel_sizes, raw.data(),
+                         raw_size);
+    }
+    if (!ok) {
+      return false;
+    }
+    data = raw.data();
+  }
+
+  // Every line stores all values of one channel after the other.
+  for (int y = 0; y < ny; ++y) {
+    const int row = flip_vertically ? first_row + num_rows - 1 - (y0 + y)
+                                    : y0 + y - first_row;
+    uint16_t* out = out_rgb + (static_cast<size_t>(row) * width_ + x0) * 3;
+    for (size_t c = 0; c < channels_.size(); ++c) {
+      const Channel& channel = channels_[c];
+      for (int k = 0; k < 3; ++k) {
+        if (rgb_channels_[k] != static_cast<int>(c)) {
+          continue;
+        }
+        for (int x = 0; x < nx; ++x) {
+          out[3 * x + k] =
+              ToHalf(data + x * channel.size, channel.pixel_type);
+        }
+      }
+      data += nx * channel.size;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+
+// Reads single part OpenEXR images in scanline or tiled layout with NONE, ZIPS,
+// ZIP or PIZ compression. The R, G and B channels are read, or Y for luminance
+// images, stored as half, float or uint. Tiled files are read at their full
+// resolution level. The file is memory mapped and its chunks are decoded on
+// several threads.
+class ExrFile {
+ public:
+  ExrFile();
+
+  ExrFile(const ExrFile&) = delete;
+  ExrFile& operator=(const ExrFile&) = delete;
+
+  // Maps |file| and reads its header. Returns false if the file can't be read
+  // or uses features that aren't supported.
+  bool Open(const char* file);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Decodes the image to width() * height() tightly packed RGB half floats,
+  // bottom row first if |flip_vertically| is set. A |thread_count| of 0 uses
+  // GetDefaultThreadCount().
+  bool DecodeToHalf(uint16_t* out_rgb, bool flip_vertically,
+                    int thread_count = 0) const;
+
+  // Number of rows the image is decoded in at a time, a scanline block or a
+  // row of tiles.
+  int chunk_rows() const { return tiled_ ? tile_height_ : lines_per_chunk_; }
+
+  // Decodes |num_rows| rows from |first_row| down to tightly packed RGB half
+  // floats, top row first. |first_row| must be a multiple of chunk_rows() and
+  // so must |num_rows| unless the rows end at the bottom of the image.
+  bool DecodeRowsToHalf(int first_row, int num_rows, uint16_t* out_rgb,
+                        int thread_count = 0) const;
+
+ private:
+  struct Channel {
+    std::string name;
+    int pixel_type;
+    int size;
+  };
+
+  bool ReadHeader(const uint8_t** cursor, const uint8_t* end);
+  // Decode chunks [|begin|, |end|), which must lie within the |num_rows| rows
+  // from |first_row| that |out_rgb| holds.
+  bool DecodeChunks(int begin, int end, int first_row, int num_rows,
+                    uint16_t* out_rgb, bool flip_vertically,
+                    int thread_count) const;
+  bool DecodeChunk(int index, int first_row, int num_rows, uint16_t* out_rgb,
+                   bool flip_vertically) const;
+
+  MappedFile file_;
+  int width_;
+  int height_;
+  int min_x_;
+  int min_y_;
+  int compression_;
+  // Channels in file order, which is sorted by name.
+  std::vector<Channel> channels_;
+  // Channel of each of R, G and B.
+  int rgb_channels_[3];
+  bool tiled_;
+  int tile_width_;
+  int tile_height_;
+  int lines_per_chunk_;
+  std::vector<uint64_t> chunk_offsets_;
+};
@@ -0,0 +1,10 @@
+#include "flags.h"
+
+bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  const std::string prefix = std::string("--") + name + "=";
+  if (std::string(arg).compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg + prefix.size();
+  return true;
+}
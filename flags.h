@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+// Returns true and sets |value| if |arg| has the form "--<name>=<value>".
+bool ParseFlag(const char* arg, const char* name, std::string* value);
@@ -0,0 +1,152 @@
+#include "gl_context.h"
+
+// Must be before GLFW.
+#include <glad/glad.h>
+// Must be after GLAD.
+#include <GLFW/glfw3.h>
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <iostream>
+#include <mutex>
+
+namespace {
+GLFWwindow* InitWindow() {
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+#ifdef __APPLE__
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+  GLFWwindow* window =
+      glfwCreateWindow(512, 512, "Environment Map Tool", NULL, NULL);
+  if (window == NULL) {
+    std::cout << "Failed to create GLFW window" << std::endl;
+    glfwTerminate();
+    return nullptr;
+  }
+  glfwMakeContextCurrent(window);
+
+  // Initializer GLAD.
+  gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+
+  return window;
+}
+
+#ifdef __linux__
+// Every headless context is created on the same display, which is initialized
+// with the first context and terminated with the last one.
+std::mutex display_mutex;
+int num_display_contexts = 0;
+
+EGLDisplay GetDisplay() {
+  // Surfaceless contexts need no display server or window system.
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+          eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  EGLDisplay display = EGL_NO_DISPLAY;
+  if (get_platform_display) {
+    display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                   EGL_DEFAULT_DISPLAY, nullptr);
+  }
+  if (display == EGL_NO_DISPLAY) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+  return display;
+}
+
+void ReleaseDisplay(EGLDisplay display) {
+  std::lock_guard<std::mutex> lock(display_mutex);
+  if (--num_display_contexts == 0) {
+    eglTerminate(display);
+  }
+}
+
+bool InitHeadless(GlContext* context) {
+  EGLDisplay display = GetDisplay();
+  {
+    std::lock_guard<std::mutex> lock(display_mutex);
+    if (display == EGL_NO_DISPLAY ||
+        (num_display_contexts == 0 &&
+         !eglInitialize(display, nullptr, nullptr))) {
+      std::cout << "Failed to initialize EGL" << std::endl;
+      return false;
+    }
+    ++num_display_contexts;
+  }
+  // The bound API is per thread.
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    std::cout << "Failed to initialize EGL" << std::endl;
+    ReleaseDisplay(display);
+    return false;
+  }
+
+  const EGLint context_attributes[] = {
+      EGL_CONTEXT_MAJOR_VERSION,
+      3,
+      EGL_CONTEXT_MINOR_VERSION,
+      3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK,
+      EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE,
+  };
+  EGLContext egl_context = eglCreateContext(
+      display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attributes);
+  if (egl_context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context)) {
+    std::cout << "Failed to create EGL context" << std::endl;
+    if (egl_context != EGL_NO_CONTEXT) {
+      eglDestroyContext(display, egl_context);
+    }
+    ReleaseDisplay(display);
+    return false;
+  }
+
+  context->egl_display = display;
+  context->egl_context = egl_context;
+  // EGL entry points don't depend on the context, so they are loaded once for
+  // all threads.
+  static std::once_flag load_once;
+  std::call_once(load_once,
+                 []() { gladLoadGLLoader((GLADloadproc)eglGetProcAddress); });
+  return true;
+}
+#endif
+}  // namespace
+
+bool CreateGlContext(bool headless, GlContext* context) {
+  if (!headless) {
+    context->window = InitWindow();
+    return context->window != nullptr;
+  }
+#ifdef __linux__
+  return InitHeadless(context);
+#else
+  std::cout << "Headless contexts are only supported on Linux" << std::endl;
+  return false;
+#endif
+}
+
+void DestroyGlContext(GlContext* context) {
+  if (context->window) {
+    glfwDestroyWindow(context->window);
+    glfwTerminate();
+    context->window = nullptr;
+  }
+#ifdef __linux__
+  if (context->egl_display) {
+    eglMakeCurrent(context->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroyContext(context->egl_display, context->egl_context);
+    ReleaseDisplay(context->egl_display);
+    context->egl_display = nullptr;
+    context->egl_context = nullptr;
+  }
+#endif
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+struct GLFWwindow;
+
+// An OpenGL 3.3 core context, either backed by a hidden GLFW window or created
+// headless through EGL.
+struct GlContext {
+  GLFWwindow* window = nullptr;
+  void* egl_display = nullptr;
+  void* egl_context = nullptr;
+};
+
+// Creates a context, makes it current and loads the GL entry points. Headless
+// contexts have no surface and run without a display server, e.g. on Mesa
+// llvmpipe. They are only supported on Linux, and several of them can be used
+// at once, each current on its own thread. Returns false on failure.
+bool CreateGlContext(bool headless, GlContext* context);
+void DestroyGlContext(GlContext* context);
@@ -0,0 +1,267 @@
+#include "hdr_reader.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <string>
+#include "parallel.h"
+#include "pixel_formats.h"
+
+namespace {
+// Reads the header lines with |read_line|, which returns a line without the
+// newline or false at the end of the file.
+bool ReadHeader(const std::function<bool(std::string*)>& read_line,
+                int* width, int* height) {
+  std::string line;
+  if (!read_line(&line) || (line != "#?RADIANCE" && line != "#?RGBE")) {
+    return false;
+  }
+  // Header variables end with an empty line.
+  bool rgbe = false;
+  while (read_line(&line) && !line.empty()) {
+    if (line == "FORMAT=32-bit_rle_rgbe") {
+      rgbe = true;
+    }
+  }
+  if (!rgbe || !read_line(&line)) {
+    return false;
+  }
+  return sscanf(line.c_str(), "-Y %d +X %d", height, width) == 2 &&
+         *width > 0 && *height > 0;
+}
+
+// Scanlines of 8 to 32767 pixels are usually run length encoded per channel.
+// They start with 2, 2 and the width. Other scanlines are flat RGBE.
+bool IsRunLengthEncoded(const uint8_t* start, int width) {
+  return width >= 8 && width < 32768 && start[0] == 2 && start[1] == 2 &&
+         !(start[2] & 0x80);
+}
+
+// Decodes the scanline at |data| to |out_rgbe|, or only finds its end if
+// |out_rgbe| is null. Returns the end of the scanline or null if it is
+// malformed.
+const uint8_t* DecodeScanline(const uint8_t* data, const uint8_t* end,
+                              int width, uint8_t* out_rgbe) {
+  if (end - data < 4) {
+    return nullptr;
+  }
+  if (!IsRunLengthEncoded(data, width)) {
+    if (end - data < 4 * static_cast<ptrdiff_t>(width)) {
+      return nullptr;
+    }
+    if (out_rgbe) {
+      memcpy(out_rgbe, data, 4 * width);
+    }
+    return data + 4 * width;
+  }
+  if (((data[2] << 8) | data[3]) != width) {
+    return nullptr;
+  }
+
+  data += 4;
+  for (int channel = 0; channel < 4; ++channel) {
+    int x = 0;
+    while (x < width) {
+      if (data == end) {
+        return nullptr;
+      }
+      int count = *data++;
+      if (count > 128) {
+        // A run of a single value.
+        count -= 128;
+        if (data == end || x + count > width) {
+          return nullptr;
+        }
+        if (out_rgbe) {
+          for (int i = 0; i < count; ++i) {
+            out_rgbe[4 * (x + i) + channel] = *data;
+          }
+        }
+        ++data;
+      } else {
+        if (count == 0 || x + count > width || end - data < count) {
+          return nullptr;
+        }
+        if (out_rgbe) {
+          for (int i = 0; i < count; ++i) {
+            out_rgbe[4 * (x + i) + channel] = data[i];
+          }
+        }
+        data += count;
+      }
+      x += count;
+    }
+  }
+  return data;
+}
+}  // namespace
+
+HdrReader::HdrReader()
+    : file_(nullptr), width_(0), height_(0), next_scanline_(0) {}
+
+HdrReader::~HdrReader() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool HdrReader::Open(const char* file) {
+  file_ = fopen(file, "rb");
+  if (!file_) {
+    return false;
+  }
+
+  FILE* stream = file_;
+  const auto read_line = [stream](std::string* line) {
+    line->clear();
+    for (int c = fgetc(stream); c != '\n'; c = fgetc(stream)) {
+      if (c == EOF) {
+        return false;
+      }
+      *line += static_cast<char>(c);
+    }
+    return true;
+  };
+  if (!ReadHeader(read_line, &width_, &height_)) {
+    return false;
+  }
+  rgbe_.resize(static_cast<size_t>(width_) * 4);
+  return true;
+}
+
+bool HdrReader::ReadScanline(float* out_rgb) {
+  if (!file_ || next_scanline_ >= height_ || !ReadRgbe()) {
+    return false;
+  }
+  ++next_scanline_;
+
+  for (int x = 0; x < width_; ++x) {
+    const unsigned char* rgbe = &rgbe_[4 * x];
+    float* rgb = out_rgb + 3 * x;
+    if (rgbe[3] == 0) {
+      rgb[0] = rgb[1] = rgb[2] = 0.0f;
+      continue;
+    }
+    const float scale = std::ldexp(1.0f, rgbe[3] - (128 + 8));
+    rgb[0] = rgbe[0] * scale;
+    rgb[1] = rgbe[1] * scale;
+    rgb[2] = rgbe[2] * scale;
+  }
+  return true;
+}
+
+bool HdrReader::ReadRgbe() {
+  unsigned char start[4];
+  if (fread(start, 1, 4, file_) != 4) {
+    return false;
+  }
+  if (!IsRunLengthEncoded(start, width_)) {
+    memcpy(rgbe_.data(), start, 4);
+    return fread(&rgbe_[4], 4, width_ - 1, file_) ==
+           static_cast<size_t>(width_ - 1);
+  }
+  if (((start[2] << 8) | start[3]) != width_) {
+    return false;
+  }
+
+  for (int channel = 0; channel < 4; ++channel) {
+    int x = 0;
+    while (x < width_) {
+      int count = fgetc(file_);
+      if (count == EOF) {
+        return false;
+      }
+      if (count > 128) {
+        // A run of a single value.
+        count -= 128;
+        const int value = fgetc(file_);
+        if (value == EOF || x + count > width_) {
+          return false;
+        }
+        for (int i = 0; i < count; ++i, ++x) {
+          rgbe_[4 * x + channel] = static_cast<unsigned char>(value);
+        }
+      } else {
+        if (count == 0 || x + count > width_) {
+          return false;
+        }
+        for (int i = 0; i < count; ++i, ++x) {
+          const int value = fgetc(file_);
+          if (value == EOF) {
+            return false;
+          }
+          rgbe_[4 * x + channel] = static_cast<unsigned char>(value);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+MappedHdrFile::MappedHdrFile() : width_(0), height_(0) {}
+
+bool MappedHdrFile::Open(const char* file) {
+  if (!file_.Open(file)) {
+    return false;
+  }
+
+  const uint8_t* cursor = file_.data();
+  const uint8_t* end = file_.data() + file_.size();
+  const auto read_line = [&cursor, end](std::string* line) {
+    const uint8_t* newline =
+        static_cast<const uint8_t*>(memchr(cursor, '\n', end - cursor));
+    if (!newline) {
+      return false;
+    }
+    line->assign(reinterpret_cast<const char*>(cursor), newline - cursor);
+    cursor = newline + 1;
+    return true;
+  };
+  if (!ReadHeader(read_line, &width_, &height_)) {
+    return false;
+  }
+
+  scanlines_.resize(height_);
+  for (int y = 0; y < height_; ++y) {
+    scanlines_[y] = cursor - file_.data();
+    cursor = DecodeScanline(cursor, end, width_, nullptr);
+    if (!cursor) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MappedHdrFile::DecodeToHalf(uint16_t* out_rgb, bool flip_vertically,
+                                 int thread_count) const {
+  // RGBE values are m * 2^(e - 136), which are exact in float.
+  float scales[256];
+  scales[0] = 0.0f;
+  for (int e = 1; e < 256; ++e) {
+    scales[e] = std::ldexp(1.0f, e - (128 + 8));
+  }
+
+  std::atomic<bool> failed(false);
+  const uint8_t* end = file_.data() + file_.size();
+  ParallelFor(height_,
+              [&](int y) {
+                std::vector<uint8_t> rgbe(static_cast<size_t>(width_) * 4);
+                if (!DecodeScanline(file_.data() + scanlines_[y], end, width_,
+                                    rgbe.data())) {
+                  failed = true;
+                  return;
+                }
+                const int row = flip_vertically ? height_ - 1 - y : y;
+                uint16_t* out =
+                    out_rgb + static_cast<size_t>(row) * width_ * 3;
+                for (int x = 0; x < width_; ++x) {
+                  const float scale = scales[rgbe[4 * x + 3]];
+                  out[3 * x] = FloatToHalf(rgbe[4 * x] * scale);
+                  out[3 * x + 1] = FloatToHalf(rgbe[4 * x + 1] * scale);
+                  out[3 * x + 2] = FloatToHalf(rgbe[4 * x + 2] * scale);
+                }
+              },
+              thread_count);
+  return !failed;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "mapped_file.h"
+
+// Readers for Radiance .hdr (RGBE) images. Only the standard
+// "-Y <height> +X <width>" orientation is supported, where scanlines run from
+// the top of the image down.
+
+// Reads an image one scanline at a time, so images far larger than the
+// available memory can be processed.
+class HdrReader {
+ public:
+  HdrReader();
+  ~HdrReader();
+
+  HdrReader(const HdrReader&) = delete;
+  HdrReader& operator=(const HdrReader&) = delete;
+
+  // Opens |file| and reads its header. Returns false if the file can't be read
+  // or isn't a supported .hdr image.
+  bool Open(const char* file);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Decodes the next scanline to width() tightly packed RGB floats. Returns
+  // false on a read error or past the last scanline.
+  bool ReadScanline(float* out_rgb);
+
+ private:
+  bool ReadRgbe();
+
+  FILE* file_;
+  int width_;
+  int height_;
+  int next_scanline_;
+  std::vector<unsigned char> rgbe_;
+};
+
+// Decodes a whole image from a memory mapped file. The scanlines are located in
+// a quick pass over the run lengths and then decoded on several threads.
+class MappedHdrFile {
+ public:
+  MappedHdrFile();
+
+  MappedHdrFile(const MappedHdrFile&) = delete;
+  MappedHdrFile& operator=(const MappedHdrFile&) = delete;
+
+  // Maps |file| and finds its scanlines. Returns false if the file can't be
+  // read or isn't a supported, complete .hdr image.
+  bool Open(const char* file);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Decodes the image to width() * height() tightly packed RGB half floats,
+  // bottom row first if |flip_vertically| is set. A |thread_count| of 0 uses
+  // GetDefaultThreadCount().
+  bool DecodeToHalf(uint16_t* out_rgb, bool flip_vertically,
+                    int thread_count = 0) const;
+
+ private:
+  MappedFile file_;
+  int width_;
+  int height_;
+  // Offset of every scanline in |file_|.
+  std::vector<size_t> scanlines_;
+};
@@ -0,0 +1,1276 @@
+#include "ibl.h"
+
+#include <glad/glad.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <mathfu/constants.h>
+#include <mathfu/glsl_mappings.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "exr_reader.h"
+#include "hdr_reader.h"
+#include "memory.h"
+#include "parallel.h"
+#include "pixel_formats.h"
+#include "program_cache.h"
+#include "trace.h"
+
+namespace {
+template <typename T>
+T DegreesToRadians(T degrees) {
+  return degrees * static_cast<T>(0.01745329251994329576923690768489);
+}
+
+void RenderCube() {
+  thread_local unsigned int cube_vao = 0;
+  thread_local unsigned int cube_vbo = 0;
+  if (cube_vao == 0) {
+    float vertices[] = {
+        // Back face.
+        -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f,  // bottom-left
+        1.0f, 1.0f, -1.0f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f,    // top-right
+        1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f,   // bottom-right
+        1.0f, 1.0f, -1.0f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f,    // top-right
+        -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f,  // bottom-left
+        -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f,   // top-left
+        // Front face.
+        -1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,  // bottom-left
+        1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,   // bottom-right
+        1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,    // top-right
+        1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,    // top-right
+        -1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,   // top-left
+        -1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,  // bottom-left
+        // Left face.
+        -1.0f, 1.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f,    // top-right
+        -1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f,   // top-left
+        -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-left
+        -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-left
+        -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f,   // bottom-right
+        -1.0f, 1.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f,    // top-right
+        // right face
+        1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,    // top-left
+        1.0f, -1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-right
+        1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f,   // top-right
+        1.0f, -1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f,  // bottom-right
+        1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,    // top-left
+        1.0f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f,   // bottom-left
+        // Bottom face.
+        -1.0f, -1.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f,  // top-right
+        1.0f, -1.0f, -1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 1.0f,   // top-left
+        1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,    // bottom-left
+        1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,    // bottom-left
+        -1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f,   // bottom-right
+        -1.0f, -1.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f,  // top-right
+        // Top face.
+        -1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,  // top-left
+        1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,    // bottom-right
+        1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f,   // top-right
+        1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,    // bottom-right
+        -1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,  // top-left
+        -1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f    // bottom-left
+    };
+    glGenVertexArrays(1, &cube_vao);
+    glGenBuffers(1, &cube_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+    // Link vertex attributes.
+    glBindVertexArray(cube_vao);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
+                          (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
+                          (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
+                          (void*)(6 * sizeof(float)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+  }
+
+  // Render the cube.
+  glBindVertexArray(cube_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 36);
+  glBindVertexArray(0);
+}
+
+// Draws a 1x1 XY quad in NDC
+void RenderQuad() {
+  thread_local unsigned int quad_vao = 0;
+  thread_local unsigned int quad_vbo = 0;
+  if (quad_vao == 0) {
+    float quadVertices[] = {
+        // positions        // texture Coords
+        -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+        1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,  -1.0f, 0.0f, 1.0f, 0.0f,
+    };
+    // setup plane VAO
+    glGenVertexArrays(1, &quad_vao);
+    glGenBuffers(1, &quad_vbo);
+    glBindVertexArray(quad_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices,
+                 GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
+                          (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
+                          (void*)(3 * sizeof(float)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+  glBindVertexArray(quad_vao);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glBindVertexArray(0);
+}
+
+bool LoadFile(const char* path, char** mem, size_t* size) {
+  assert(size);
+  assert(mem);
+
+  std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  std::streampos pos = file.tellg();
+  *mem = new char[pos];
+  *size = pos;
+
+  file.seekg(0, std::ios::beg);
+  file.read(*mem, pos);
+  file.close();
+
+  return true;
+}
+
+GLuint CompileShader(const GLenum shader_type, const char* source,
+                     const int length) {
+  GLuint shader = glCreateShader(shader_type);
+  glShaderSource(shader, 1, &source, &length);
+
+  // Compile the shader
+  glCompileShader(shader);
+
+  GLint isCompiled = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
+  if (isCompiled == GL_FALSE) {
+    std::cout << "Shader compilation failed" << std::endl;
+    GLint max_length = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &max_length);
+
+    // The max_length includes the NULL character
+    GLchar* info_log = new GLchar[max_length + 1];
+    glGetShaderInfoLog(shader, max_length, &max_length, info_log);
+    info_log[max_length] = 0;
+
+    // We don't need the shader anymore.
+    glDeleteShader(shader);
+
+    // Print the info_log.
+    std::cout << info_log << std::endl;
+
+    return 0;
+  }
+  return shader;
+}
+
+// Macros defined in front of a shader's source, as name and value.
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+std::string FloatToDefine(float value) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.9g", value);
+  return buffer;
+}
+
+// Inserts |defines| after the #version line, which must come first, and
+// restarts the line numbers so compile errors point at the file.
+std::string AddDefines(const char* source, size_t size,
+                       const ShaderDefines& defines) {
+  std::string result(source, size);
+  if (defines.empty()) {
+    return result;
+  }
+  const size_t line_end = result.find('\n');
+  std::string lines;
+  for (const auto& define : defines) {
+    lines += "#define " + define.first + " " + define.second + "\n";
+  }
+  lines += "#line 2\n";
+  result.insert(line_end == std::string::npos ? result.size() : line_end + 1,
+                lines);
+  return result;
+}
+
+void SetSamplerUniform(unsigned int program) {
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "sampler0"), 0);
+  glUseProgram(0);
+}
+
+// Loads the program from the program cache if it is enabled and has it, or
+// compiles it and stores it there.
+unsigned int CompileProgram(const char* shader, const ShaderDefines& defines) {
+  size_t frag_size, vert_size;
+  char *frag, *vert;
+  const std::string vertex_path = std::string(shader) + ".glslv";
+  const std::string fragment_path = std::string(shader) + ".glslf";
+
+  if (!LoadFile(vertex_path.c_str(), &vert, &vert_size)) {
+    assert(false);
+    return 0;
+  }
+  if (!LoadFile(fragment_path.c_str(), &frag, &frag_size)) {
+    assert(false);
+    return 0;
+  }
+  const std::string vertex_source = AddDefines(vert, vert_size, defines);
+  const std::string fragment_source = AddDefines(frag, frag_size, defines);
+  delete[] frag;
+  delete[] vert;
+
+  const std::string sources = vertex_source + '\0' + fragment_source;
+  GLuint program = LoadCachedProgram(sources);
+  if (program) {
+    SetSamplerUniform(program);
+    return program;
+  }
+
+  program = glCreateProgram();
+  if (IsProgramCacheEnabled()) {
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  GLuint vertex_shader = CompileShader(GL_VERTEX_SHADER, vertex_source.data(),
+                                       vertex_source.size());
+  GLuint fragment_shader =
+      CompileShader(GL_FRAGMENT_SHADER, fragment_source.data(),
+                    fragment_source.size());
+  glAttachShader(program, vertex_shader);
+  glAttachShader(program, fragment_shader);
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+  glLinkProgram(program);
+  SetSamplerUniform(program);
+  StoreCachedProgram(sources, program);
+  return program;
+}
+
+// Programs are compiled on first use and kept, so long running processes only
+// compile each once. Like the cube and quad buffers they belong to the
+// context current on the calling thread, so each thread has its own.
+// Every set of |defines| is a separate variant, e.g. a prefilter program with
+// the sample count and roughness of one mip as constants, which lets the
+// driver unroll and fold the sampling loop. Sizes and sample counts chosen per
+// bake would add variants without end, so only the most recently used are
+// kept; this is more than the variants of a single bake.
+const size_t kMaxPrograms = 64;
+
+struct LoadedProgram {
+  unsigned int program;
+  uint64_t last_use;
+};
+
+struct ProgramVariants {
+  std::map<std::string, LoadedProgram> programs;
+  uint64_t uses = 0;
+};
+
+ProgramVariants& GetProgramVariants() {
+  thread_local ProgramVariants variants;
+  return variants;
+}
+
+std::string GetProgramKey(const char* shader, const ShaderDefines& defines) {
+  std::string key = shader;
+  for (const auto& define : defines) {
+    key += " " + define.first + "=" + define.second;
+  }
+  return key;
+}
+
+unsigned int LoadShader(const char* shader,
+                        const ShaderDefines& defines = ShaderDefines()) {
+  ProgramVariants& variants = GetProgramVariants();
+  const std::string key = GetProgramKey(shader, defines);
+  auto it = variants.programs.find(key);
+  if (it == variants.programs.end()) {
+    if (variants.programs.size() >= kMaxPrograms) {
+      auto oldest = variants.programs.begin();
+      for (auto entry = variants.programs.begin();
+           entry != variants.programs.end(); ++entry) {
+        if (entry->second.last_use < oldest->second.last_use) {
+          oldest = entry;
+        }
+      }
+      glDeleteProgram(oldest->second.program);
+      variants.programs.erase(oldest);
+    }
+    TraceScope trace("stage", "compile " + key);
+    it = variants.programs
+             .emplace(key, LoadedProgram{CompileProgram(shader, defines), 0})
+             .first;
+  }
+  it->second.last_use = ++variants.uses;
+  return it->second.program;
+}
+
+GLenum GetSourceTarget(SourceLayout layout) {
+  return layout == SourceLayout::kEquirectangular ? GL_TEXTURE_2D
+                                                  : GL_TEXTURE_CUBE_MAP;
+}
+
+// The convolution shaders take an equirectangular source in a variant.
+void AddSourceDefines(SourceLayout layout, ShaderDefines* defines) {
+  if (layout == SourceLayout::kEquirectangular) {
+    defines->emplace_back("EQUIRECTANGULAR_SOURCE", "1");
+  }
+}
+
+ShaderDefines GetIrradianceDefines(float sample_delta, SourceLayout layout) {
+  ShaderDefines defines = {{"SAMPLE_DELTA", FloatToDefine(sample_delta)}};
+  AddSourceDefines(layout, &defines);
+  return defines;
+}
+
+ShaderDefines GetPrefilterDefines(int mip, int num_mips, int num_samples,
+                                  SourceLayout layout) {
+  const float roughness = (float)mip / (float)(num_mips - 1);
+  ShaderDefines defines = {{"SAMPLE_COUNT", std::to_string(num_samples)},
+                           {"ROUGHNESS", FloatToDefine(roughness)}};
+  AddSourceDefines(layout, &defines);
+  return defines;
+}
+
+int GetNumPrefilterMips(int cubemap_width, int cubemap_height) {
+  return 1 + std::floor(std::log2(std::max(cubemap_width, cubemap_height)));
+}
+
+// Calls |fn| with the program variants of the irradiance and prefilter maps
+// of these settings. A size of 0 leaves the map out.
+void ForEachVariant(
+    int irradiance_size, float irradiance_sample_delta, int prefilter_size,
+    int prefilter_samples, SourceLayout layout,
+    const std::function<void(const char*, const ShaderDefines&)>& fn) {
+  if (irradiance_size > 0) {
+    fn("data/irradiance_convolution",
+       GetIrradianceDefines(irradiance_sample_delta, layout));
+  }
+  const int num_mips =
+      prefilter_size > 0 ? GetNumPrefilterMips(prefilter_size, prefilter_size)
+                         : 0;
+  for (int mip = 0; mip < num_mips; ++mip) {
+    fn("data/prefilter",
+       GetPrefilterDefines(mip, num_mips, prefilter_samples, layout));
+  }
+}
+
+GLenum NumComponentsToGlFormat(int num_components) {
+  if (num_components == 1) {
+    return GL_R;
+  }
+  if (num_components == 2) {
+    return GL_RG;
+  }
+  if (num_components == 3) {
+    return GL_RGB;
+  }
+  if (num_components == 4) {
+    return GL_RGBA;
+  }
+  assert(false);
+  return GL_RGB;
+}
+
+// Returns the transform that draws face |face| of a cubemap with RenderCube().
+mathfu::mat4 GetFaceViewProjection(int face) {
+  const mathfu::mat4 projection = mathfu::mat4::Perspective(
+      DegreesToRadians(90.0f), 1.0f, 0.1f, 10.0f, -1.0f);
+  const mathfu::mat4 views[] = {
+      mathfu::mat4::LookAt(mathfu::vec3(-1.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, -1.0f, 0.0f)),
+      mathfu::mat4::LookAt(mathfu::vec3(1.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, -1.0f, 0.0f)),
+      mathfu::mat4::LookAt(mathfu::vec3(0.0f, 1.0f, 0.0f),
+                           mathfu::vec3(0.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, 0.0f, 1.0f)),
+      mathfu::mat4::LookAt(mathfu::vec3(0.0f, -1.0f, 0.0f),
+                           mathfu::vec3(0.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, 0.0f, -1.0f)),
+      mathfu::mat4::LookAt(mathfu::vec3(0.0f, 0.0f, 1.0f),
+                           mathfu::vec3(0.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, -1.0f, 0.0f)),
+      mathfu::mat4::LookAt(mathfu::vec3(0.0f, 0.0f, -1.0f),
+                           mathfu::vec3(0.0f, 0.0f, 0.0f),
+                           mathfu::vec3(0.0f, -1.0f, 0.0f))};
+  return projection * views[face];
+}
+
+// Ends of the passes of a ProgressiveMap, in prefilter samples and in columns
+// of the irradiance grid, see data/*_progressive.glslf.
+const int kNumProgressivePasses = 7;
+const unsigned int kPrefilterPassEnds[kNumProgressivePasses] = {
+    16, 32, 64, 128, 256, 512, 1024};
+const int kIrradiancePassEnds[kNumProgressivePasses] = {4,  8,   16, 32,
+                                                        64, 128, 252};
+
+// Draws scissored tiles and waits for the GPU after every chunk of them, see
+// TileOptions.
+class TileScheduler {
+ public:
+  TileScheduler(const TileOptions& options, int64_t total_texels)
+      : options_(options), total_texels_(total_texels) {}
+
+  // Calls |draw| for each tile of a |width| x |height| target with the scissor
+  // set to the tile. Returns false once canceled.
+  bool Draw(int width, int height, const std::function<void()>& draw) {
+    const int tile_size =
+        options_.tile_size > 0 ? options_.tile_size : std::max(width, height);
+    bool ok = true;
+    glEnable(GL_SCISSOR_TEST);
+    for (int y = 0; y < height && ok; y += tile_size) {
+      for (int x = 0; x < width && ok; x += tile_size) {
+        const int tile_width = std::min(tile_size, width - x);
+        const int tile_height = std::min(tile_size, height - y);
+        glScissor(x, y, tile_width, tile_height);
+        draw();
+        chunk_texels_ += static_cast<int64_t>(tile_width) * tile_height;
+        if (chunk_texels_ >= options_.texels_per_chunk) {
+          ok = Flush();
+        }
+      }
+    }
+    glDisable(GL_SCISSOR_TEST);
+    return ok;
+  }
+
+  // Waits for the tiles submitted so far and reports the progress. Returns
+  // false if canceled.
+  bool Flush() {
+    TraceScope trace("gpu", "tile fence");
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLenum status;
+    do {
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(fence);
+    done_texels_ += chunk_texels_;
+    chunk_texels_ = 0;
+    return !options_.progress ||
+           options_.progress(static_cast<float>(done_texels_) / total_texels_);
+  }
+
+ private:
+  const TileOptions& options_;
+  const int64_t total_texels_;
+  int64_t done_texels_ = 0;
+  int64_t chunk_texels_ = 0;
+};
+
+// Draws all faces at once unless |tiles| is given. Returns false if |tiles|
+// was canceled.
+bool RenderTextureToCubemap(unsigned int fbo, unsigned int fbo_texture,
+                            int width, int height, unsigned int shader,
+                            int mip = 0, TileScheduler* tiles = nullptr) {
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  glUseProgram(shader);
+
+  glViewport(0, 0, width, height);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  for (unsigned int i = 0; i < 6; ++i) {
+    const mathfu::mat4 mat_projection_view = GetFaceViewProjection(i);
+    glUniformMatrix4fv(glGetUniformLocation(shader, "uMatViewProjection"), 1,
+                       false, &mat_projection_view[0]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, fbo_texture,
+                           mip);
+    const auto draw = []() {
+      glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+      // Render a 1x1 cube.
+      RenderCube();
+    };
+    if (!tiles) {
+      draw();
+    } else if (!tiles->Draw(width, height, draw)) {
+      glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+      return false;
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+  return true;
+}
+unsigned int CreateEquirectangularTexture(int width, int height,
+                                          GLenum gl_format, GLenum gl_type,
+                                          const void* pixels) {
+  unsigned int gl_texture;
+  glGenTextures(1, &gl_texture);
+  glBindTexture(GL_TEXTURE_2D, gl_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, gl_format,
+               gl_type, pixels);
+  TrackTexture(gl_texture, GetTextureSize(width, height, 1, 6, false));
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return gl_texture;
+}
+
+// Decodes |image| on all threads straight into a mapped pixel buffer as half
+// floats, which the driver can upload without converting. Returns 0 if the
+// image can't be decoded.
+template <typename Image>
+unsigned int UploadHalfImage(const Image& image) {
+  const int64_t size = static_cast<int64_t>(image.width()) * image.height() *
+                       3 * sizeof(uint16_t);
+  ScopedMemoryCharge pbo_charge(MemoryKind::kGpu, size);
+  GLuint pbo;
+  glGenBuffers(1, &pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  void* pixels = glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  // Rows start at the bottom, like stbi_set_flip_vertically_on_load().
+  const bool decoded =
+      pixels && image.DecodeToHalf(static_cast<uint16_t*>(pixels), true);
+  const bool unmapped = pixels && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  unsigned int gl_texture = 0;
+  if (decoded && unmapped) {
+    // Rows of RGB half floats are only 2 byte aligned.
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    gl_texture = CreateEquirectangularTexture(image.width(), image.height(),
+                                              GL_RGB, GL_HALF_FLOAT, nullptr);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glDeleteBuffers(1, &pbo);
+  return gl_texture;
+}
+
+// Loads Radiance files with MappedHdrFile and OpenEXR files with ExrFile.
+// Returns 0 if neither supports |file|.
+unsigned int LoadMappedTexture(const char* file, int* out_width,
+                               int* out_height) {
+  MappedHdrFile hdr;
+  if (hdr.Open(file)) {
+    *out_width = hdr.width();
+    *out_height = hdr.height();
+    return UploadHalfImage(hdr);
+  }
+  ExrFile exr;
+  if (exr.Open(file)) {
+    *out_width = exr.width();
+    *out_height = exr.height();
+    return UploadHalfImage(exr);
+  }
+  return 0;
+}
+
+// Hands out the scanlines of an ExrFile from the top down like HdrReader. Bands
+// of chunks are decoded on all threads as they are reached, so only a band is
+// held in memory.
+class ExrScanlineReader {
+ public:
+  explicit ExrScanlineReader(const ExrFile& file)
+      : file_(file),
+        band_rows_(GetBandRows(file)),
+        band_first_(0),
+        band_count_(0),
+        next_scanline_(0) {}
+
+  int width() const { return file_.width(); }
+  int height() const { return file_.height(); }
+
+  bool ReadScanline(float* out_rgb) {
+    if (next_scanline_ >= file_.height()) {
+      return false;
+    }
+    if (next_scanline_ >= band_first_ + band_count_) {
+      band_first_ = next_scanline_;
+      band_count_ = std::min(band_rows_, file_.height() - band_first_);
+      if (band_.empty()) {
+        const size_t size =
+            static_cast<size_t>(band_rows_) * file_.width() * 3;
+        band_charge_.reset(new ScopedMemoryCharge(
+            MemoryKind::kHost, static_cast<int64_t>(size * sizeof(uint16_t))));
+        band_.resize(size);
+      }
+      if (!file_.DecodeRowsToHalf(band_first_, band_count_, band_.data())) {
+        return false;
+      }
+    }
+    const uint16_t* in =
+        &band_[static_cast<size_t>(next_scanline_ - band_first_) *
+               file_.width() * 3];
+    for (int i = 0; i < file_.width() * 3; ++i) {
+      out_rgb[i] = HalfToFloat(in[i]);
+    }
+    ++next_scanline_;
+    return true;
+  }
+
+ private:
+  // A chunk row per thread, but no more than 64 MiB unless a single chunk row
+  // is larger.
+  static int GetBandRows(const ExrFile& file) {
+    const int64_t kMaxBandBytes = 64 << 20;
+    const int64_t chunk_row_bytes = static_cast<int64_t>(file.chunk_rows()) *
+                                    file.width() * 3 * sizeof(uint16_t);
+    const int64_t chunk_rows_per_band = std::max<int64_t>(
+        1, std::min<int64_t>(GetDefaultThreadCount(),
+                             kMaxBandBytes / chunk_row_bytes));
+    return static_cast<int>(std::min<int64_t>(
+        chunk_rows_per_band * file.chunk_rows(), file.height()));
+  }
+
+  const ExrFile& file_;
+  const int band_rows_;
+  std::unique_ptr<ScopedMemoryCharge> band_charge_;
+  std::vector<uint16_t> band_;
+  int band_first_;
+  int band_count_;
+  int next_scanline_;
+};
+
+// Box filters the scanlines of |reader|, which has the interface of HdrReader,
+// into a texture for StreamHDRTexture().
+template <typename Reader>
+unsigned int StreamTexture(const char* file, Reader* reader, int max_width,
+                           int* out_width, int* out_height) {
+  GLint max_texture_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  if (max_width <= 0 || max_width > max_texture_size) {
+    max_width = max_texture_size;
+  }
+
+  // Every |factor| x |factor| source pixels are averaged into one texel.
+  const int source_width = reader->width();
+  const int source_height = reader->height();
+  int factor = 1;
+  while ((source_width + factor - 1) / factor > max_width ||
+         (source_height + factor - 1) / factor > max_texture_size) {
+    ++factor;
+  }
+  if (factor == 1) {
+    // The whole image is needed anyway, so decode it as fast as possible.
+    return LoadHDRTexture(file, out_width, out_height);
+  }
+  const int width = (source_width + factor - 1) / factor;
+  const int height = (source_height + factor - 1) / factor;
+
+  // Bands of rows are uploaded as soon as they are complete, so only a
+  // scanline, a row and a band are held in memory.
+  static const int kBandRows = 64;
+  ScopedMemoryCharge buffers_charge(
+      MemoryKind::kHost, (static_cast<int64_t>(source_width) + width +
+                          static_cast<int64_t>(width) * kBandRows) *
+                             3 * sizeof(float));
+  std::vector<float> scanline(source_width * 3);
+  std::vector<float> row(width * 3);
+  std::vector<float> band(width * kBandRows * 3);
+
+  const unsigned int gl_texture =
+      UploadEquirectangularTexture(nullptr, width, height, 3);
+  for (int band_y = 0; band_y < height; band_y += kBandRows) {
+    const int band_rows = std::min(kBandRows, height - band_y);
+    for (int y = band_y; y < band_y + band_rows; ++y) {
+      std::fill(row.begin(), row.end(), 0.0f);
+      const int rows = std::min(factor, source_height - y * factor);
+      for (int i = 0; i < rows; ++i) {
+        if (!reader->ReadScanline(scanline.data())) {
+          std::cout << "Failed to read " << file << std::endl;
+          DeleteTexture(gl_texture);
+          return 0;
+        }
+        for (int x = 0; x < source_width; ++x) {
+          float* texel = &row[(x / factor) * 3];
+          texel[0] += scanline[3 * x];
+          texel[1] += scanline[3 * x + 1];
+          texel[2] += scanline[3 * x + 2];
+        }
+      }
+
+      // The image is stored top down, but textures start at the bottom, like
+      // LoadHDRTexture() flips them.
+      float* out = &band[(band_rows - 1 - (y - band_y)) * width * 3];
+      for (int x = 0; x < width; ++x) {
+        const int columns = std::min(factor, source_width - x * factor);
+        const float scale = 1.0f / (columns * rows);
+        for (int c = 0; c < 3; ++c) {
+          out[3 * x + c] = row[3 * x + c] * scale;
+        }
+      }
+    }
+    glBindTexture(GL_TEXTURE_2D, gl_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, height - band_y - band_rows, width,
+                    band_rows, GL_RGB, GL_FLOAT, band.data());
+  }
+
+  if (out_width) {
+    *out_width = width;
+  }
+  if (out_height) {
+    *out_height = height;
+  }
+  return gl_texture;
+}
+}  // namespace
+
+unsigned int UploadEquirectangularTexture(const float* pixels, int width,
+                                          int height, int num_components) {
+  return CreateEquirectangularTexture(width, height,
+                                      NumComponentsToGlFormat(num_components),
+                                      GL_FLOAT, pixels);
+}
+
+unsigned int LoadHDRTexture(const char* file, int* out_width,
+                            int* out_height) {
+  TraceScope trace("io", "LoadHDRTexture");
+  int width, height;
+  unsigned int gl_texture = LoadMappedTexture(file, &width, &height);
+  if (!gl_texture) {
+    int num_components;
+    stbi_set_flip_vertically_on_load(true);
+    float* data = stbi_loadf(file, &width, &height, &num_components, 0);
+    if (!data) {
+      std::cout << "Failed to load HDR image." << std::endl;
+      return 0;
+    }
+    ScopedMemoryCharge image_charge(
+        MemoryKind::kHost,
+        static_cast<int64_t>(width) * height * num_components * sizeof(float));
+
+    gl_texture =
+        UploadEquirectangularTexture(data, width, height, num_components);
+    stbi_image_free(data);
+  }
+
+  if (out_width) {
+    *out_width = width;
+  }
+  if (out_height) {
+    *out_height = height;
+  }
+  return gl_texture;
+}
+
+unsigned int StreamHDRTexture(const char* file, int max_width, int* out_width,
+                              int* out_height) {
+  TraceScope trace("io", "StreamHDRTexture");
+  HdrReader hdr;
+  if (hdr.Open(file)) {
+    return StreamTexture(file, &hdr, max_width, out_width, out_height);
+  }
+  ExrFile exr;
+  if (exr.Open(file)) {
+    ExrScanlineReader reader(exr);
+    return StreamTexture(file, &reader, max_width, out_width, out_height);
+  }
+  return 0;
+}
+
+unsigned int LoadEquirectangularTexture(const char* file, int max_width) {
+  // Formats the streaming readers don't support go through LoadHDRTexture().
+  const GLuint equirectangular_texture =
+      StreamHDRTexture(file, max_width, nullptr, nullptr);
+  if (equirectangular_texture) {
+    return equirectangular_texture;
+  }
+  return LoadHDRTexture(file, nullptr, nullptr);
+}
+
+unsigned int ConvertEquirectangularToCubemap(const char* file,
+                                             int cubemap_width,
+                                             int cubemap_height) {
+  // A face spans a quarter of the equirectangular width, so source detail past
+  // 4 * |cubemap_width| is never sampled.
+  const GLuint equirectangular_texture =
+      LoadEquirectangularTexture(file, 4 * cubemap_width);
+  if (!equirectangular_texture) {
+    return 0;
+  }
+
+  const unsigned int cubemap = ConvertEquirectangularTextureToCubemap(
+      equirectangular_texture, cubemap_width, cubemap_height);
+  DeleteTexture(equirectangular_texture);
+  return cubemap;
+}
+
+unsigned int ConvertEquirectangularTextureToCubemap(
+    unsigned int equirectangular_texture, int cubemap_width,
+    int cubemap_height) {
+  TraceScope trace("stage", "ConvertEquirectangularTextureToCubemap", true);
+  // Create framebuffer.
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  // Generate the textures for the framebuffer.
+  unsigned int cubemap;
+  glGenTextures(1, &cubemap);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+  for (unsigned int i = 0; i < 6; ++i) {
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
+                 cubemap_width, cubemap_height, 0, GL_RGB, GL_FLOAT, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+
+  // Draw each face of the cubemap, sampling from the equirectangular texture to
+  // generate the cubemap.
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, equirectangular_texture);
+  const unsigned int shader = LoadShader("data/equirectangular_to_cubemap");
+  RenderTextureToCubemap(fbo, cubemap, cubemap_width, cubemap_height, shader);
+
+  // Generate mipmaps for the cubemap.
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+  glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  TrackTexture(cubemap,
+               GetTextureSize(cubemap_width, cubemap_height, 6, 6, true));
+
+  glDeleteFramebuffers(1, &fbo);
+
+  return cubemap;
+}
+
+void GenerateEquirectangularMipmaps(unsigned int equirectangular_texture) {
+  TraceScope trace("stage", "GenerateEquirectangularMipmaps", true);
+  glBindTexture(GL_TEXTURE_2D, equirectangular_texture);
+  GLint width, height;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+  // Longitudes wrap around, so filtering at u = 0 and 1 blends both edges.
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  TrackTexture(equirectangular_texture,
+               GetTextureSize(width, height, 1, 6, true) -
+                   GetTextureSize(width, height, 1, 6, false));
+}
+
+unsigned int GenerateIrradianceMap(unsigned int texture, int cubemap_width,
+                                   int cubemap_height, float sample_delta,
+                                   SourceLayout layout) {
+  TraceScope trace("stage", "GenerateIrradianceMap", true);
+  // Create framebuffer.
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  // Generate the textures for the framebuffer.
+  unsigned int cubemap;
+  glGenTextures(1, &cubemap);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+  for (unsigned int i = 0; i < 6; ++i) {
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
+                 cubemap_width, cubemap_height, 0, GL_RGB, GL_FLOAT, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+
+  // Draw each face of the cubemap, sampling from the equirectangular texture to
+  // generate the cubemap.
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GetSourceTarget(layout), texture);
+  const unsigned int shader =
+      LoadShader("data/irradiance_convolution",
+                 GetIrradianceDefines(sample_delta, layout));
+  RenderTextureToCubemap(fbo, cubemap, cubemap_width, cubemap_height, shader);
+  TrackTexture(cubemap,
+               GetTextureSize(cubemap_width, cubemap_height, 6, 6, false));
+
+  glDeleteFramebuffers(1, &fbo);
+
+  return cubemap;
+}
+
+unsigned int GeneratePreFilteredMap(unsigned int texture, int cubemap_width,
+                                    int cubemap_height, int num_samples,
+                                    const TileOptions& tiles,
+                                    SourceLayout layout) {
+  TraceScope trace("stage", "GeneratePreFilteredMap", true);
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  // Generate fbo.
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  // Generate the textures for the framebuffer.
+  unsigned int cubemap;
+  glGenTextures(1, &cubemap);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+  for (unsigned int i = 0; i < 6; ++i) {
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
+                 cubemap_width, cubemap_height, 0, GL_RGB, GL_FLOAT, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  TrackTexture(cubemap,
+               GetTextureSize(cubemap_width, cubemap_height, 6, 6, true));
+
+  const int num_mips = GetNumPrefilterMips(cubemap_width, cubemap_height);
+  // Each mip has its own variant, all compiled before the first tile is drawn.
+  std::vector<unsigned int> shaders(num_mips);
+  for (int mip = 0; mip < num_mips; ++mip) {
+    shaders[mip] = LoadShader(
+        "data/prefilter",
+        GetPrefilterDefines(mip, num_mips, num_samples, layout));
+  }
+  // Every texel takes the same number of samples, so the progress is the
+  // fraction of texels drawn.
+  const int64_t total_texels =
+      GetTextureSize(cubemap_width, cubemap_height, 6, 1, true);
+  TileScheduler scheduler(tiles, total_texels);
+  bool ok = true;
+  for (int mip = 0; mip < num_mips && ok; ++mip) {
+    unsigned int width = cubemap_width * std::pow(0.5, mip);
+    unsigned int height = cubemap_height * std::pow(0.5, mip);
+
+    // Draw each face of the cubemap, sampling from the equirectangular texture
+    // to generate the cubemap.
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GetSourceTarget(layout), texture);
+    ok = RenderTextureToCubemap(fbo, cubemap, width, height, shaders[mip],
+                                mip, &scheduler);
+  }
+  ok = ok && scheduler.Flush();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+  glDeleteFramebuffers(1, &fbo);
+  if (!ok) {
+    DeleteTexture(cubemap);
+    return 0;
+  }
+  return cubemap;
+}
+
+ProgressiveMap::ProgressiveMap(Kind kind, unsigned int texture, int size)
+    : kind_(kind),
+      source_(texture),
+      size_(size),
+      num_mips_(kind == kPrefilter
+                    ? 1 + static_cast<int>(std::floor(std::log2(size)))
+                    : 1) {
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  // A 2D array rather than a cubemap, so the resolve can fetch its texels.
+  glGenTextures(1, &accumulation_);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, accumulation_);
+  for (int mip = 0; mip < num_mips_; ++mip) {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, mip, GL_RGBA32F, std::max(1, size >> mip),
+                 std::max(1, size >> mip), 6, 0, GL_RGBA, GL_FLOAT, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, num_mips_ - 1);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  TrackTexture(accumulation_,
+               GetTextureSize(size, size, 6, 16, num_mips_ > 1));
+
+  glGenFramebuffers(1, &fbo_);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  for (int mip = 0; mip < num_mips_; ++mip) {
+    for (int face = 0; face < 6; ++face) {
+      glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                accumulation_, mip, face);
+      glClear(GL_COLOR_BUFFER_BIT);
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+}
+
+ProgressiveMap::~ProgressiveMap() {
+  glDeleteFramebuffers(1, &fbo_);
+  DeleteTexture(accumulation_);
+}
+
+void ProgressiveMap::Refine() {
+  if (done()) {
+    return;
+  }
+  const int pass = num_passes_done_++;
+  const char* name = kind_ == kPrefilter ? "prefilter" : "irradiance";
+  TraceScope trace("stage", std::string(name) + " pass " + std::to_string(pass),
+                   true);
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  unsigned int shader;
+  if (kind_ == kPrefilter) {
+    shader = LoadShader("data/prefilter_progressive");
+    glUseProgram(shader);
+    glUniform1ui(glGetUniformLocation(shader, "sampleBegin"),
+                 pass > 0 ? kPrefilterPassEnds[pass - 1] : 0);
+    glUniform1ui(glGetUniformLocation(shader, "sampleEnd"),
+                 kPrefilterPassEnds[pass]);
+  } else {
+    shader = LoadShader("data/irradiance_progressive");
+    glUseProgram(shader);
+    glUniform1i(glGetUniformLocation(shader, "columnBegin"),
+                pass > 0 ? kIrradiancePassEnds[pass - 1] : 0);
+    glUniform1i(glGetUniformLocation(shader, "columnEnd"),
+                kIrradiancePassEnds[pass]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, source_);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  // Adds the sums of this pass to those of the previous ones.
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+  for (int mip = 0; mip < num_mips_; ++mip) {
+    if (kind_ == kPrefilter) {
+      const float roughness = (float)mip / (float)(num_mips_ - 1);
+      glUniform1f(glGetUniformLocation(shader, "roughness"), roughness);
+    }
+    glViewport(0, 0, std::max(1, size_ >> mip), std::max(1, size_ >> mip));
+    for (int face = 0; face < 6; ++face) {
+      const mathfu::mat4 mat_projection_view = GetFaceViewProjection(face);
+      glUniformMatrix4fv(glGetUniformLocation(shader, "uMatViewProjection"), 1,
+                         false, &mat_projection_view[0]);
+      glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                accumulation_, mip, face);
+      RenderCube();
+    }
+  }
+  glDisable(GL_BLEND);
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+}
+
+bool ProgressiveMap::done() const {
+  return num_passes_done_ == kNumProgressivePasses;
+}
+
+float ProgressiveMap::fraction() const {
+  if (num_passes_done_ == 0) {
+    return 0.0f;
+  }
+  return kind_ == kPrefilter
+             ? kPrefilterPassEnds[num_passes_done_ - 1] /
+                   static_cast<float>(
+                       kPrefilterPassEnds[kNumProgressivePasses - 1])
+             : kIrradiancePassEnds[num_passes_done_ - 1] /
+                   static_cast<float>(
+                       kIrradiancePassEnds[kNumProgressivePasses - 1]);
+}
+
+unsigned int ProgressiveMap::Resolve() const {
+  TraceScope trace("stage", "resolve progressive map", true);
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  unsigned int cubemap;
+  glGenTextures(1, &cubemap);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+  for (unsigned int i = 0; i < 6; ++i) {
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, size_,
+                 size_, 0, GL_RGB, GL_FLOAT, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                  num_mips_ > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  if (num_mips_ > 1) {
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  }
+  TrackTexture(cubemap, GetTextureSize(size_, size_, 6, 6, num_mips_ > 1));
+
+  const unsigned int shader = LoadShader("data/progressive_resolve");
+  glUseProgram(shader);
+  // The irradiance grid is a Riemann sum over the hemisphere.
+  glUniform1f(glGetUniformLocation(shader, "scale"),
+              kind_ == kIrradiance ? 3.14159265359f : 1.0f);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, accumulation_);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  for (int mip = 0; mip < num_mips_; ++mip) {
+    glUniform1i(glGetUniformLocation(shader, "mip"), mip);
+    glViewport(0, 0, std::max(1, size_ >> mip), std::max(1, size_ >> mip));
+    for (int face = 0; face < 6; ++face) {
+      glUniform1i(glGetUniformLocation(shader, "face"), face);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubemap,
+                             mip);
+      RenderQuad();
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+  return cubemap;
+}
+
+int CountUncompiledVariants(int irradiance_size, float irradiance_sample_delta,
+                            int prefilter_size, int prefilter_samples,
+                            SourceLayout layout) {
+  const auto& programs = GetProgramVariants().programs;
+  int count = 0;
+  ForEachVariant(irradiance_size, irradiance_sample_delta, prefilter_size,
+                 prefilter_samples, layout,
+                 [&](const char* shader, const ShaderDefines& defines) {
+                   count += !programs.count(GetProgramKey(shader, defines));
+                 });
+  return count;
+}
+
+void CompileVariants(int irradiance_size, float irradiance_sample_delta,
+                     int prefilter_size, int prefilter_samples,
+                     SourceLayout layout) {
+  ForEachVariant(irradiance_size, irradiance_sample_delta, prefilter_size,
+                 prefilter_samples, layout,
+                 [](const char* shader, const ShaderDefines& defines) {
+                   LoadShader(shader, defines);
+                 });
+}
+
+unsigned int GenerateOctahedralMap(unsigned int cubemap, int size,
+                                   int num_mips) {
+  TraceScope trace("stage", "GenerateOctahedralMap", true);
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+  unsigned int texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  for (int mip = 0; mip < num_mips; ++mip) {
+    const int mip_size = std::max(1, size >> mip);
+    glTexImage2D(GL_TEXTURE_2D, mip, GL_RGB16F, mip_size, mip_size, 0, GL_RGB,
+                 GL_FLOAT, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_mips - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  num_mips > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  TrackTexture(texture, GetTextureSize(size, size, 1, 6, num_mips > 1));
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  const unsigned int shader = LoadShader("data/octahedral");
+  glUseProgram(shader);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+  for (int mip = 0; mip < num_mips; ++mip) {
+    const int mip_size = std::max(1, size >> mip);
+    glUniform1i(glGetUniformLocation(shader, "mip"), mip);
+    glUniform1i(glGetUniformLocation(shader, "size"), mip_size);
+    glViewport(0, 0, mip_size, mip_size);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, texture, mip);
+    RenderQuad();
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+  glDeleteFramebuffers(1, &fbo);
+  return texture;
+}
+
+unsigned int UploadBrdfLookUpTable(const float* pixels, int width,
+                                   int height) {
+  TraceScope trace("io", "UploadBrdfLookUpTable");
+  // Converted here rather than by the driver, so the texture holds the same
+  // halves as WriteBrdfToKtx() writes from |pixels|.
+  std::vector<uint16_t> halves(width * height * 2);
+  for (size_t i = 0; i < halves.size(); ++i) {
+    halves[i] = FloatToHalf(pixels[i]);
+  }
+  unsigned int brdf_lut_texture;
+  glGenTextures(1, &brdf_lut_texture);
+  glBindTexture(GL_TEXTURE_2D, brdf_lut_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG,
+               GL_HALF_FLOAT, halves.data());
+  TrackTexture(brdf_lut_texture, GetTextureSize(width, height, 1, 4, false));
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return brdf_lut_texture;
+}
+
+unsigned int GenerateBRDFLookUpTable(int width, int height) {
+  TraceScope trace("stage", "GenerateBRDFLookUpTable", true);
+  GLint old_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+  unsigned int shader = LoadShader("data/brdf");
+
+  // Generate the textures for the framebuffer.
+  unsigned int brdf_lut_texture;
+  glGenTextures(1, &brdf_lut_texture);
+  glBindTexture(GL_TEXTURE_2D, brdf_lut_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT,
+               nullptr);
+  TrackTexture(brdf_lut_texture, GetTextureSize(width, height, 1, 4, false));
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  // Create framebuffer.
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         brdf_lut_texture, 0);
+
+  // Draw the full screen quad.
+  glViewport(0, 0, width, height);
+  glUseProgram(shader);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  RenderQuad();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+  glDeleteFramebuffers(1, &fbo);
+  return brdf_lut_texture;
+}
+
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// GPU stages of the image based lighting pipeline. They need a current OpenGL
+// 3.3 core context and load their shaders from data/. The programs are compiled
+// on first use and reused for the lifetime of the thread, so each thread must
+// keep using the context it first used, though threads may use contexts of
+// their own. Textures are returned as GL names owned by the caller.
+
+// Uploads tightly packed float pixels as an RGB16F texture for
+// ConvertEquirectangularTextureToCubemap(). |pixels| may be null to only
+// allocate the texture.
+unsigned int UploadEquirectangularTexture(const float* pixels, int width,
+                                          int height, int num_components);
+
+// Loads a Radiance .hdr or an OpenEXR .exr file. Returns 0 if the file can't be
+// read.
+unsigned int LoadHDRTexture(const char* file, int* out_width,
+                            int* out_height);
+
+// Loads a Radiance .hdr file a scanline at a time, or an OpenEXR .exr file a
+// band of chunks at a time, and box filters it by an integer factor until it is
+// at most |max_width| wide and fits GL_MAX_TEXTURE_SIZE. A |max_width| of 0
+// only applies the GL limit. Returns 0 if the file can't be read or uses an
+// unsupported orientation or feature.
+unsigned int StreamHDRTexture(const char* file, int max_width, int* out_width,
+                              int* out_height);
+
+// Loads |file| with StreamHDRTexture() at most |max_width| wide, or with
+// LoadHDRTexture() if the streaming reader doesn't support it.
+unsigned int LoadEquirectangularTexture(const char* file, int max_width);
+
+// Loads |file| at the resolution the cubemap needs and converts it.
+unsigned int ConvertEquirectangularToCubemap(const char* file,
+                                             int cubemap_width,
+                                             int cubemap_height);
+unsigned int ConvertEquirectangularTextureToCubemap(
+    unsigned int equirectangular_texture, int cubemap_width,
+    int cubemap_height);
+
+// Generates the mip levels of an equirectangular texture, so the irradiance
+// and prefilter maps can sample it directly with
+// SourceLayout::kEquirectangular instead of a cubemap converted from it.
+void GenerateEquirectangularMipmaps(unsigned int equirectangular_texture);
+
+// Layout of the source texture of the irradiance and prefilter maps.
+enum class SourceLayout { kCubemap, kEquirectangular };
+
+// Defaults of the sample counts, which trade quality for bake time. The
+// irradiance map sums a grid of samples |sample_delta| radians apart over the
+// hemisphere and the prefilter map takes |num_samples| per texel.
+const float kDefaultIrradianceSampleDelta = 0.025f;
+const int kDefaultPrefilterSamples = 1024;
+
+unsigned int GenerateIrradianceMap(
+    unsigned int texture, int cubemap_width, int cubemap_height,
+    float sample_delta = kDefaultIrradianceSampleDelta,
+    SourceLayout layout = SourceLayout::kCubemap);
+
+// How GeneratePreFilteredMap() splits its passes. Large faces are drawn in
+// scissored tiles and the tiles are submitted in chunks, each waited for with a
+// fence, so no single submission runs long enough to trip a GPU watchdog and
+// other work gets the GPU between chunks.
+struct TileOptions {
+  // Side of the tiles in texels. 0 draws whole faces.
+  int tile_size = 256;
+  // Texels submitted before waiting for the GPU.
+  int64_t texels_per_chunk = 1 << 20;
+  // Called after every chunk with the fraction of the texels done. Returning
+  // false cancels the pass.
+  std::function<bool(float fraction)> progress;
+};
+
+// Returns 0 if |tiles.progress| canceled it.
+unsigned int GeneratePreFilteredMap(
+    unsigned int texture, int cubemap_width, int cubemap_height,
+    int num_samples = kDefaultPrefilterSamples,
+    const TileOptions& tiles = TileOptions(),
+    SourceLayout layout = SourceLayout::kCubemap);
+
+// Returns how many program variants GenerateIrradianceMap() and
+// GeneratePreFilteredMap() would compile on the calling thread for these
+// settings, as they aren't among the programs it keeps. A size of 0 leaves
+// the map out.
+int CountUncompiledVariants(int irradiance_size, float irradiance_sample_delta,
+                            int prefilter_size, int prefilter_samples,
+                            SourceLayout layout);
+// Compiles those variants ahead of the maps, e.g. to time the compiles.
+void CompileVariants(int irradiance_size, float irradiance_sample_delta,
+                     int prefilter_size, int prefilter_samples,
+                     SourceLayout layout);
+
+// Renders the first |num_mips| levels of |cubemap| into an RGB16F octahedral
+// 2D texture of |size| x |size| texels, halved per level like the cubemap. A
+// direction d is at uv = d.xy / (|d.x| + |d.y| + |d.z|) for d.z >= 0 and at
+// (1 - |uv.yx|) * sign(uv) past the diagonals for d.z < 0, with uv in [-1, 1]
+// spanning all but a one texel border. The border repeats the texels across
+// each edge for seamless bilinear filtering. Levels of 2x2 texels or less
+// hold the mean of the cubemap level. |size| should be twice the face size
+// of the cubemap, which keeps about 2/3 of its texels.
+unsigned int GenerateOctahedralMap(unsigned int cubemap, int size,
+                                   int num_mips);
+
+// Accumulates the irradiance or prefilter map of a cubemap over passes of
+// growing sample counts in an RGBA32F target, so a noisy map is available
+// after the first pass, with 1/64 of the samples, and refines until all are
+// taken. The irradiance map sums the same grid as GenerateIrradianceMap() and
+// the prefilter map as many samples as GeneratePreFilteredMap(), taken from
+// the Sobol sequence instead of the Hammersley set, which can't be split into
+// evenly spread passes.
+class ProgressiveMap {
+ public:
+  enum Kind { kIrradiance, kPrefilter };
+
+  // |texture| is the source cubemap and must outlive the map.
+  ProgressiveMap(Kind kind, unsigned int texture, int size);
+  ~ProgressiveMap();
+
+  ProgressiveMap(const ProgressiveMap&) = delete;
+  ProgressiveMap& operator=(const ProgressiveMap&) = delete;
+
+  // Takes the next pass of samples. Each pass takes as many as all before it.
+  void Refine();
+  bool done() const;
+  // Fraction of the samples taken so far.
+  float fraction() const;
+  int num_mips() const { return num_mips_; }
+
+  // Returns the map of the samples taken so far as an RGB16F cubemap, owned by
+  // the caller, like GenerateIrradianceMap() or GeneratePreFilteredMap().
+  unsigned int Resolve() const;
+
+ private:
+  const Kind kind_;
+  const unsigned int source_;
+  const int size_;
+  const int num_mips_;
+  unsigned int accumulation_;
+  unsigned int fbo_;
+  int num_passes_done_ = 0;
+};
+
+unsigned int GenerateBRDFLookUpTable(int width, int height);
+// Uploads tightly packed RG floats, e.g. of IntegrateBrdfLookUpTable(), as
+// the RG16F texture GenerateBRDFLookUpTable() renders.
+unsigned int UploadBrdfLookUpTable(const float* pixels, int width, int height);
@@ -15,7 +15,7 @@ uint32_t GetNumKeyValuePairs(const char* mem,
   while (bytes_read < bytes_of_key_value_data) {
     uint32_t key_and_value_byte_size =
         *reinterpret_cast<const uint32_t*>(mem + bytes_read);
-    bytes_read += key_and_value_byte_size +
+    bytes_read += sizeof(uint32_t) + key_and_value_byte_size +
                   CalculateKeyValuePairPadding(key_and_value_byte_size);
     ++num_key_value_pairs;
   }
@@ -33,7 +33,7 @@ bool GetKeyValuePair(uint32_t index, uint32_t bytes_of_key_value_data,
     }
     uint32_t key_and_value_byte_size =
         *reinterpret_cast<const uint32_t*>(mem + bytes_read);
-    bytes_read += key_and_value_byte_size +
+    bytes_read += sizeof(uint32_t) + key_and_value_byte_size +
                   CalculateKeyValuePairPadding(key_and_value_byte_size);
     ++current_index;
   }
@@ -42,11 +42,69 @@ bool GetKeyValuePair(uint32_t index, uint32_t bytes_of_key_value_data,
       *reinterpret_cast<const uint32_t*>(mem + bytes_read);
   bytes_read += sizeof(uint32_t);
   out->key = mem + bytes_read;
-  bytes_read += strlen(out->key);
-  out->value = mem + bytes_read;
-  bytes_read += strlen(out->value);
-  out->padding = mem + bytes_read;
+  out->value = out->key + strlen(out->key) + 1;
+  out->padding = out->key + out->key_and_value_byte_size;
   return true;
 }
 
+void AppendKeyValuePair(const std::string& key, const std::string& value,
+                        std::string* out) {
+  const uint32_t key_and_value_byte_size =
+      static_cast<uint32_t>(key.size() + 1 + value.size() + 1);
+  out->append(reinterpret_cast<const char*>(&key_and_value_byte_size),
+              sizeof(key_and_value_byte_size));
+  out->append(key.c_str(), key.size() + 1);
+  out->append(value.c_str(), value.size() + 1);
+  out->append(CalculateKeyValuePairPadding(key_and_value_byte_size), '\0');
+}
+
+bool GetImageData(const char* mem, size_t size, uint32_t mip, uint32_t face,
+                  KtxHeader* out_header, const char** out_data,
+                  uint32_t* out_size) {
+  const KtxHeader expected = KtxHeader();
+  if (size < sizeof(KtxHeader)) {
+    return false;
+  }
+  KtxHeader header;
+  memcpy(&header, mem, sizeof(header));
+  if (memcmp(header.identifier, expected.identifier,
+             sizeof(header.identifier)) != 0 ||
+      header.endianness != expected.endianness) {
+    return false;
+  }
+  const uint32_t num_mips = header.number_of_mipmap_levels > 0
+                                ? header.number_of_mipmap_levels
+                                : 1;
+  if (mip >= num_mips || face >= header.number_of_faces) {
+    return false;
+  }
+  const bool per_face = header.number_of_faces == 6 &&
+                        header.number_of_array_elements == 0;
+
+  size_t offset = sizeof(KtxHeader) + header.bytes_of_key_value_data;
+  for (uint32_t level = 0; level <= mip; ++level) {
+    uint32_t image_size;
+    if (offset + sizeof(image_size) > size) {
+      return false;
+    }
+    memcpy(&image_size, mem + offset, sizeof(image_size));
+    offset += sizeof(image_size);
+
+    const uint32_t face_stride = image_size + 3 - ((image_size + 3) % 4);
+    const size_t level_size =
+        per_face ? static_cast<size_t>(face_stride) * 6 : face_stride;
+    if (offset + level_size > size) {
+      return false;
+    }
+    if (level == mip) {
+      *out_header = header;
+      *out_data = mem + offset + (per_face ? face_stride * face : 0);
+      *out_size = image_size;
+      return true;
+    }
+    offset += level_size;
+  }
+  return false;
+}
+
 }  // namespace ktx
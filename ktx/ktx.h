@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
 
 namespace ktx {
 
@@ -32,4 +34,17 @@ uint32_t CalculateKeyValuePairPadding(uint32_t key_and_value_byte_size);
 uint32_t GetNumKeyValuePairs(const char* mem, uint32_t bytes_of_key_value_data);
 bool GetKeyValuePair(uint32_t index, uint32_t bytes_of_key_value_data,
                      const char* mem, KtxKeyValuePair* out);
+
+// Appends |key| and |value|, both stored with a terminating NUL, and the
+// padding to |out|, the key/value data following the header.
+void AppendKeyValuePair(const std::string& key, const std::string& value,
+                        std::string* out);
+
+// Finds the image data of |face| in level |mip| of the KTX file in |mem|. For
+// non-array cubemaps the result is a single face, otherwise the whole level.
+// Returns false if the file is invalid, uses a different endianness or doesn't
+// contain the image.
+bool GetImageData(const char* mem, size_t size, uint32_t mip, uint32_t face,
+                  KtxHeader* out_header, const char** out_data,
+                  uint32_t* out_size);
 }  // namespace ktx
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Read-only view of a whole file. The file is memory mapped where supported and
+// read into memory otherwise.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Returns false if |file| can't be read or is empty.
+  bool Open(const char* file);
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  // Whether |data_| is mapped rather than read into |buffer_|.
+  bool mapped_;
+  std::vector<uint8_t> buffer_;
+};
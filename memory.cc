@@ -0,0 +1,163 @@
+#include "memory.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+struct Stage {
+  std::string name;
+  bool active;
+  int64_t peak[2];
+};
+
+std::mutex mutex;
+int64_t current[2] = {0, 0};
+int64_t peak[2] = {0, 0};
+int64_t peak_total = 0;
+int64_t budget = 0;
+// Keyed by creation order, so ResetMemoryStages() can drop finished stages
+// while the ids of running ones stay valid.
+std::map<int, Stage> stages;
+int next_stage_id = 0;
+// Texture names are only unique within a context, and every context is used
+// from a single thread, so textures are keyed by thread and name.
+std::map<std::pair<std::thread::id, unsigned int>, int64_t> textures;
+
+// Needs |mutex| to be held.
+void Charge(MemoryKind kind, int64_t bytes) {
+  const int index = static_cast<int>(kind);
+  current[index] += bytes;
+  peak[index] = std::max(peak[index], current[index]);
+  peak_total = std::max(peak_total, current[0] + current[1]);
+  for (auto& entry : stages) {
+    Stage& stage = entry.second;
+    if (stage.active) {
+      stage.peak[index] = std::max(stage.peak[index], current[index]);
+    }
+  }
+}
+
+double ToMb(int64_t bytes) { return bytes / (1024.0 * 1024.0); }
+}  // namespace
+
+ScopedMemoryCharge::ScopedMemoryCharge(MemoryKind kind, int64_t bytes)
+    : kind_(kind), bytes_(bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Charge(kind_, bytes_);
+}
+
+ScopedMemoryCharge::~ScopedMemoryCharge() {
+  std::lock_guard<std::mutex> lock(mutex);
+  Charge(kind_, -bytes_);
+}
+
+void TrackTexture(unsigned int texture, int64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  textures[std::make_pair(std::this_thread::get_id(), texture)] += bytes;
+  Charge(MemoryKind::kGpu, bytes);
+}
+
+void DeleteTexture(unsigned int texture) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it =
+        textures.find(std::make_pair(std::this_thread::get_id(), texture));
+    if (it != textures.end()) {
+      Charge(MemoryKind::kGpu, -it->second);
+      textures.erase(it);
+    }
+  }
+  glDeleteTextures(1, &texture);
+}
+
+int64_t GetTextureSize(int width, int height, int faces, int bytes_per_texel,
+                       bool mipmapped) {
+  int64_t size = 0;
+  while (true) {
+    size += static_cast<int64_t>(width) * height * faces * bytes_per_texel;
+    if (!mipmapped || (width == 1 && height == 1)) {
+      return size;
+    }
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+}
+
+MemoryStage::MemoryStage(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  id_ = next_stage_id++;
+  stages[id_] = {name, true, {current[0], current[1]}};
+}
+
+MemoryStage::~MemoryStage() {
+  std::lock_guard<std::mutex> lock(mutex);
+  stages[id_].active = false;
+}
+
+void ResetMemoryStages() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto it = stages.begin(); it != stages.end();) {
+    if (it->second.active) {
+      ++it;
+    } else {
+      it = stages.erase(it);
+    }
+  }
+}
+
+void SetMemoryBudget(int64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  budget = bytes;
+}
+
+bool SetMemoryBudgetMb(const std::string& megabytes) {
+  char* end;
+  const double value = std::strtod(megabytes.c_str(), &end);
+  if (megabytes.empty() || *end || !std::isfinite(value) || !(value > 0)) {
+    return false;
+  }
+  SetMemoryBudget(static_cast<int64_t>(value * 1024 * 1024));
+  return true;
+}
+
+int64_t GetMemoryBudget() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return budget;
+}
+
+bool FitsMemoryBudget(int64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return budget == 0 || current[0] + current[1] + bytes <= budget;
+}
+
+void PrintMemoryReport(std::ostream& out) {
+  std::lock_guard<std::mutex> lock(mutex);
+  char line[256];
+  snprintf(line, sizeof(line), "%-32s %12s %12s\n", "stage", "host_peak_mb",
+           "gpu_peak_mb");
+  out << line;
+  for (const auto& entry : stages) {
+    const Stage& stage = entry.second;
+    snprintf(line, sizeof(line), "%-32s %12.1f %12.1f\n", stage.name.c_str(),
+             ToMb(stage.peak[0]), ToMb(stage.peak[1]));
+    out << line;
+  }
+  snprintf(line, sizeof(line), "%-32s %12.1f %12.1f\n", "overall",
+           ToMb(peak[0]), ToMb(peak[1]));
+  out << line;
+  if (budget > 0) {
+    snprintf(line, sizeof(line), "Peak %.1f MB of a %.1f MB budget%s\n",
+             ToMb(peak_total), ToMb(budget),
+             peak_total > budget ? ", over budget" : "");
+    out << line;
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Accounting of the large host buffers and GPU textures of the pipeline. Only
+// allocations that scale with the image size are tracked, so the totals are a
+// lower bound of what the process uses. With a software renderer such as
+// llvmpipe GPU memory is host memory too, so budgets cover both.
+
+enum class MemoryKind {
+  kHost = 0,
+  kGpu,
+};
+
+// Charges |bytes| to the current totals for the lifetime of the object.
+class ScopedMemoryCharge {
+ public:
+  ScopedMemoryCharge(MemoryKind kind, int64_t bytes);
+  ~ScopedMemoryCharge();
+
+  ScopedMemoryCharge(const ScopedMemoryCharge&) = delete;
+  ScopedMemoryCharge& operator=(const ScopedMemoryCharge&) = delete;
+
+ private:
+  const MemoryKind kind_;
+  const int64_t bytes_;
+};
+
+// Tracks |bytes| of GPU memory for |texture| until DeleteTexture().
+void TrackTexture(unsigned int texture, int64_t bytes);
+// Deletes a texture and releases the memory tracked for it.
+void DeleteTexture(unsigned int texture);
+
+// Size of a 2D or cube map texture with a full mip chain from |width| x
+// |height| down to 1x1, or only the base level if |mipmapped| is false.
+int64_t GetTextureSize(int width, int height, int faces, int bytes_per_texel,
+                       bool mipmapped);
+
+// Records the peak host and GPU memory between construction and destruction
+// under |name|. Stages can nest; a stage's peak includes its children.
+class MemoryStage {
+ public:
+  explicit MemoryStage(const std::string& name);
+  ~MemoryStage();
+
+  MemoryStage(const MemoryStage&) = delete;
+  MemoryStage& operator=(const MemoryStage&) = delete;
+
+ private:
+  int id_;
+};
+
+// Forgets the stages that have finished, e.g. once a long running process
+// has reported a job, so the list doesn't grow with every job.
+void ResetMemoryStages();
+
+// A budget of 0, the default, is unlimited.
+void SetMemoryBudget(int64_t bytes);
+// Sets the budget from a --memory_budget_mb value. Returns false, leaving the
+// budget unchanged, unless |megabytes| is a positive finite number.
+bool SetMemoryBudgetMb(const std::string& megabytes);
+int64_t GetMemoryBudget();
+
+// Whether |bytes| more host or GPU memory stay within the budget.
+bool FitsMemoryBudget(int64_t bytes);
+
+// Prints the peak host and GPU memory per stage and overall.
+void PrintMemoryReport(std::ostream& out);
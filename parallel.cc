@@ -0,0 +1,111 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "trace.h"
+
+namespace {
+// A single ParallelFor() call. Helpers that only get to run after all indices
+// were taken find nothing left to do, so the caller never waits for them.
+struct Job {
+  const std::function<void(int)>* fn;
+  int count;
+  std::atomic<int> next_index;
+  std::atomic<int> num_done;
+  std::mutex mutex;
+  std::condition_variable done;
+};
+
+void RunJob(const std::shared_ptr<Job>& job) {
+  TraceScope trace("cpu", "ParallelFor worker");
+  int num_done = 0;
+  for (int i = job->next_index++; i < job->count; i = job->next_index++) {
+    (*job->fn)(i);
+    ++num_done;
+  }
+  if (num_done > 0 && job->num_done.fetch_add(num_done) + num_done ==
+                          job->count) {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->done.notify_all();
+  }
+}
+
+// Threads are started on demand and then kept for the lifetime of the process,
+// so repeated calls, e.g. per encoded face or per bake of a long running
+// process, don't pay for thread creation.
+class ThreadPool {
+ public:
+  void Run(const std::shared_ptr<Job>& job, int num_helpers) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (; num_threads_ < num_helpers; ++num_threads_) {
+      std::thread([this]() { WorkerLoop(); }).detach();
+    }
+    for (int i = 0; i < num_helpers; ++i) {
+      jobs_.push_back(job);
+    }
+    work_.notify_all();
+  }
+
+ private:
+  void WorkerLoop() {
+    for (;;) {
+      std::shared_ptr<Job> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_.wait(lock, [this]() { return !jobs_.empty(); });
+        job = jobs_.front();
+        jobs_.pop_front();
+      }
+      RunJob(job);
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::deque<std::shared_ptr<Job>> jobs_;
+  int num_threads_ = 0;
+};
+
+ThreadPool* GetThreadPool() {
+  // Never destroyed; the idle workers end with the process.
+  static ThreadPool* pool = new ThreadPool();
+  return pool;
+}
+}  // namespace
+
+int GetDefaultThreadCount() {
+  const unsigned int num_cpus = std::thread::hardware_concurrency();
+  return num_cpus > 0 ? static_cast<int>(num_cpus) : 1;
+}
+
+void ParallelFor(int count, const std::function<void(int)>& fn,
+                 int thread_count) {
+  if (thread_count <= 0) {
+    thread_count = GetDefaultThreadCount();
+  }
+  thread_count = std::min(thread_count, count);
+  if (thread_count <= 1) {
+    for (int i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->fn = &fn;
+  job->count = count;
+  job->next_index = 0;
+  job->num_done = 0;
+  GetThreadPool()->Run(job, thread_count - 1);
+
+  // The calling thread does its share of the work too, which also keeps nested
+  // calls from pool threads making progress.
+  RunJob(job);
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->done.wait(lock, [&job]() { return job->num_done == job->count; });
+}
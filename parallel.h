@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+
+// Number of worker threads used when a thread count of 0 is requested.
+int GetDefaultThreadCount();
+
+// Calls |fn| for every index in [0, count) from up to |thread_count| threads
+// and returns once all calls have finished. Indices are handed out one at a
+// time, so uneven work is balanced between the threads. A |thread_count| of 0
+// uses GetDefaultThreadCount().
+void ParallelFor(int count, const std::function<void(int)>& fn,
+                 int thread_count = 0);
@@ -0,0 +1,263 @@
+#include "pixel_formats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace {
+uint32_t FloatToBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float BitsToFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Converts to an unsigned float with a 5 bit exponent and |mantissa_bits| of
+// mantissa, as used by GL_R11F_G11F_B10F. Negative values and NaN become 0 and
+// values that are too large are clamped to the largest finite value.
+uint32_t FloatToUnsignedSmallFloat(float value, int mantissa_bits) {
+  const uint32_t max_value =
+      (0x1Eu << mantissa_bits) | ((1u << mantissa_bits) - 1);
+  if (!(value > 0.0f)) {
+    return 0;
+  }
+
+  const uint32_t bits = FloatToBits(value);
+  const int exponent = static_cast<int>((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mantissa = bits & 0x7FFFFF;
+  if (exponent >= 31) {
+    return max_value;
+  }
+
+  if (exponent <= 0) {
+    // Denormal.
+    if (exponent < -mantissa_bits) {
+      return 0;
+    }
+    mantissa |= 0x800000;
+    const int shift = 23 - mantissa_bits + 1 - exponent;
+    return (mantissa + (1u << (shift - 1))) >> shift;
+  }
+
+  const int shift = 23 - mantissa_bits;
+  uint32_t result = (static_cast<uint32_t>(exponent) << mantissa_bits) |
+                    (mantissa >> shift);
+  // Round half up. A carry out of the mantissa correctly bumps the exponent.
+  result += (mantissa >> (shift - 1)) & 1;
+  return std::min(result, max_value);
+}
+
+uint8_t UnitFloatToByte(float value) {
+  value = std::min(1.0f, std::max(0.0f, value));
+  return static_cast<uint8_t>(value * 255.0f + 0.5f);
+}
+}  // namespace
+
+bool PixelFormatFromString(const std::string& name, PixelFormat* format) {
+  assert(format);
+  if (name == "rgba16f") {
+    *format = PixelFormat::kRgba16f;
+  } else if (name == "r11g11b10f") {
+    *format = PixelFormat::kR11G11B10f;
+  } else if (name == "rgb9e5") {
+    *format = PixelFormat::kRgb9E5;
+  } else if (name == "rgbm") {
+    *format = PixelFormat::kRgbm;
+  } else if (name == "rgbd") {
+    *format = PixelFormat::kRgbd;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int GetBytesPerPixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::kRgba16f:
+      return 8;
+    case PixelFormat::kR11G11B10f:
+    case PixelFormat::kRgb9E5:
+    case PixelFormat::kRgbm:
+    case PixelFormat::kRgbd:
+      return 4;
+  }
+  assert(false);
+  return 0;
+}
+
+uint16_t FloatToHalf(float value) {
+  const uint32_t bits = FloatToBits(value);
+  const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  const uint32_t abs_bits = bits & 0x7FFFFFFF;
+
+  if (abs_bits >= 0x7F800000) {
+    // Infinity or NaN.
+    return sign | 0x7C00 | (abs_bits > 0x7F800000 ? 0x200 : 0);
+  }
+  if (abs_bits >= 0x477FF000) {
+    // Rounds to infinity.
+    return sign | 0x7C00;
+  }
+
+  uint32_t result;
+  uint32_t remainder;
+  uint32_t halfway;
+  if (abs_bits < 0x38800000) {
+    // Denormal half.
+    if (abs_bits < 0x33000000) {
+      return sign;
+    }
+    const uint32_t mantissa = (abs_bits & 0x7FFFFF) | 0x800000;
+    const int shift = 126 - static_cast<int>(abs_bits >> 23);
+    result = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    result = (abs_bits >> 13) - (112u << 10);
+    remainder = abs_bits & 0x1FFF;
+    halfway = 0x1000;
+  }
+
+  // Round to nearest even.
+  if (remainder > halfway || (remainder == halfway && (result & 1))) {
+    ++result;
+  }
+  return sign | static_cast<uint16_t>(result);
+}
+
+float HalfToFloat(uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  const uint32_t exponent = (value >> 10) & 0x1F;
+  const uint32_t mantissa = value & 0x3FF;
+
+  if (exponent == 0) {
+    const float magnitude = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+    return sign ? -magnitude : magnitude;
+  }
+  if (exponent == 31) {
+    return BitsToFloat(sign | 0x7F800000 | (mantissa << 13));
+  }
+  return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+uint32_t PackR11G11B10F(const float* rgb) {
+  return FloatToUnsignedSmallFloat(rgb[0], 6) |
+         (FloatToUnsignedSmallFloat(rgb[1], 6) << 11) |
+         (FloatToUnsignedSmallFloat(rgb[2], 5) << 22);
+}
+
+uint32_t PackRgb9E5(const float* rgb) {
+  // See EXT_texture_shared_exponent.
+  static const int kMantissaBits = 9;
+  static const int kExponentBias = 15;
+  static const float kSharedExponentMax = 65408.0f;
+
+  float clamped[3];
+  for (int i = 0; i < 3; ++i) {
+    // The comparison also maps NaN to 0.
+    clamped[i] =
+        rgb[i] > 0.0f ? std::min(rgb[i], kSharedExponentMax) : 0.0f;
+  }
+  const float max_component =
+      std::max(clamped[0], std::max(clamped[1], clamped[2]));
+
+  int shared_exponent = -kExponentBias - 1;
+  if (max_component > 0.0f) {
+    shared_exponent = std::max(shared_exponent, std::ilogb(max_component));
+  }
+  shared_exponent += 1 + kExponentBias;
+
+  float scale = std::ldexp(1.0f, kExponentBias + kMantissaBits - shared_exponent);
+  const int max_mantissa =
+      static_cast<int>(std::floor(max_component * scale + 0.5f));
+  if (max_mantissa == (1 << kMantissaBits)) {
+    ++shared_exponent;
+    scale *= 0.5f;
+  }
+
+  uint32_t result = static_cast<uint32_t>(shared_exponent) << 27;
+  for (int i = 0; i < 3; ++i) {
+    const uint32_t mantissa =
+        static_cast<uint32_t>(std::floor(clamped[i] * scale + 0.5f));
+    result |= std::min(mantissa, 511u) << (kMantissaBits * i);
+  }
+  return result;
+}
+
+float LinearToSrgb(float value) {
+  if (value <= 0.0031308f) {
+    return std::max(0.0f, value) * 12.92f;
+  }
+  return 1.055f * std::pow(std::min(value, 1.0f), 1.0f / 2.4f) - 0.055f;
+}
+
+void EncodeRgbm(const float* rgb, uint8_t* out_rgba, bool srgb) {
+  const float max_component =
+      std::max(rgb[0], std::max(rgb[1], std::max(rgb[2], 1e-6f)));
+  float multiplier = std::min(max_component / kRgbmMaxRange, 1.0f);
+  multiplier = std::ceil(multiplier * 255.0f) / 255.0f;
+
+  const float scale = 1.0f / (multiplier * kRgbmMaxRange);
+  for (int i = 0; i < 3; ++i) {
+    const float value = rgb[i] * scale;
+    out_rgba[i] = UnitFloatToByte(srgb ? LinearToSrgb(value) : value);
+  }
+  out_rgba[3] = UnitFloatToByte(multiplier);
+}
+
+void EncodeRgbd(const float* rgb, uint8_t* out_rgba) {
+  const float max_component =
+      std::max(rgb[0], std::max(rgb[1], std::max(rgb[2], 1e-6f)));
+  float divider = std::max(kRgbdMaxRange / max_component, 1.0f);
+  divider = std::min(1.0f, std::max(std::floor(divider) / 255.0f, 1.0f / 255.0f));
+
+  out_rgba[0] = UnitFloatToByte(rgb[0] * divider);
+  out_rgba[1] = UnitFloatToByte(rgb[1] * divider);
+  out_rgba[2] = UnitFloatToByte(rgb[2] * divider);
+  out_rgba[3] = UnitFloatToByte(divider);
+}
+
+void ConvertRgbFloatPixels(const float* rgb, size_t num_pixels,
+                           PixelFormat format, void* out) {
+  switch (format) {
+    case PixelFormat::kRgba16f: {
+      uint16_t* dst = static_cast<uint16_t*>(out);
+      for (size_t i = 0; i < num_pixels; ++i) {
+        dst[4 * i] = FloatToHalf(rgb[3 * i]);
+        dst[4 * i + 1] = FloatToHalf(rgb[3 * i + 1]);
+        dst[4 * i + 2] = FloatToHalf(rgb[3 * i + 2]);
+        dst[4 * i + 3] = 0x3C00;
+      }
+    } break;
+    case PixelFormat::kR11G11B10f: {
+      uint32_t* dst = static_cast<uint32_t*>(out);
+      for (size_t i = 0; i < num_pixels; ++i) {
+        dst[i] = PackR11G11B10F(rgb + 3 * i);
+      }
+    } break;
+    case PixelFormat::kRgb9E5: {
+      uint32_t* dst = static_cast<uint32_t*>(out);
+      for (size_t i = 0; i < num_pixels; ++i) {
+        dst[i] = PackRgb9E5(rgb + 3 * i);
+      }
+    } break;
+    case PixelFormat::kRgbm: {
+      uint8_t* dst = static_cast<uint8_t*>(out);
+      for (size_t i = 0; i < num_pixels; ++i) {
+        EncodeRgbm(rgb + 3 * i, dst + 4 * i);
+      }
+    } break;
+    case PixelFormat::kRgbd: {
+      uint8_t* dst = static_cast<uint8_t*>(out);
+      for (size_t i = 0; i < num_pixels; ++i) {
+        EncodeRgbd(rgb + 3 * i, dst + 4 * i);
+      }
+    } break;
+  }
+}
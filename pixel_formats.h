@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Uncompressed pixel formats that cubemaps can be written to KTX with.
+enum class PixelFormat {
+  kRgba16f = 0,
+  kR11G11B10f,
+  kRgb9E5,
+  kRgbm,
+  kRgbd,
+};
+
+// RGBM stores color / (M * kRgbmMaxRange), so values up to kRgbmMaxRange can be
+// represented. Decode with rgb * a * kRgbmMaxRange.
+static const float kRgbmMaxRange = 8.0f;
+
+// RGBD stores color * D with D in [1/255, 1]. Decode with rgb / a.
+static const float kRgbdMaxRange = 255.0f;
+
+// Parses a format name such as "rgba16f", "r11g11b10f", "rgb9e5", "rgbm" or
+// "rgbd". Returns false if the name is unknown.
+bool PixelFormatFromString(const std::string& name, PixelFormat* format);
+
+// Size of a single texel of |format| in bytes.
+int GetBytesPerPixel(PixelFormat format);
+
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
+
+// GL_R11F_G11F_B10F packed as GL_UNSIGNED_INT_10F_11F_11F_REV.
+uint32_t PackR11G11B10F(const float* rgb);
+
+// GL_RGB9_E5 packed as GL_UNSIGNED_INT_5_9_9_9_REV.
+uint32_t PackRgb9E5(const float* rgb);
+
+float LinearToSrgb(float value);
+
+// With |srgb| the RGB channels are stored sRGB encoded so they can be sampled
+// from an sRGB texture. The multiplier in alpha is always linear.
+void EncodeRgbm(const float* rgb, uint8_t* out_rgba, bool srgb = false);
+void EncodeRgbd(const float* rgb, uint8_t* out_rgba);
+
+// Converts |num_pixels| tightly packed RGB float pixels to |format|. |out| must
+// hold num_pixels * GetBytesPerPixel(format) bytes.
+void ConvertRgbFloatPixels(const float* rgb, size_t num_pixels,
+                           PixelFormat format, void* out);
@@ -0,0 +1,176 @@
+#include "program_cache.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "trace.h"
+
+namespace {
+// Guards |directory|, which any baking thread reads.
+std::mutex mutex;
+std::string directory;
+
+const char kMagic[4] = {'I', 'B', 'L', 'P'};
+
+std::string GetGlString(GLenum name) {
+  const GLubyte* value = glGetString(name);
+  return value ? reinterpret_cast<const char*>(value) : "";
+}
+
+// FNV-1a, which is enough to tell sources and drivers apart.
+uint64_t Hash(const std::string& data, uint64_t hash) {
+  for (const char c : data) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Whether the current context can save and load program binaries, which
+// GL 4.1 and ARB_get_program_binary provide, in at least one format. Queried
+// once per thread, like its context.
+bool SupportsProgramBinaries() {
+  thread_local int supported = -1;
+  if (supported < 0) {
+    GLint num_formats = 0;
+    if ((GLAD_GL_VERSION_4_1 || GLAD_GL_ARB_get_program_binary) &&
+        glProgramBinary && glGetProgramBinary && glProgramParameteri) {
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    }
+    supported = num_formats > 0;
+    static std::atomic<bool> warned(false);
+    if (!supported && !warned.exchange(true)) {
+      std::cout << "The driver can't save program binaries, so the program "
+                   "cache is disabled"
+                << std::endl;
+    }
+  }
+  return supported != 0;
+}
+
+std::string GetDirectory() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return directory;
+}
+
+// Returns the path of the entry for |sources| on the current driver, or an
+// empty string if the cache is disabled.
+std::string GetEntryPath(const std::string& sources) {
+  const std::string cache_directory = GetDirectory();
+  if (cache_directory.empty() || !SupportsProgramBinaries()) {
+    return "";
+  }
+  uint64_t hash = 14695981039346656037ull;
+  hash = Hash(GetGlString(GL_VENDOR), hash);
+  hash = Hash(GetGlString(GL_RENDERER), hash);
+  hash = Hash(GetGlString(GL_VERSION), hash);
+  hash = Hash(sources, hash);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bin",
+           static_cast<unsigned long long>(hash));
+  return cache_directory + "/" + name;
+}
+}  // namespace
+
+void SetProgramCacheDirectory(const std::string& cache_directory) {
+  std::lock_guard<std::mutex> lock(mutex);
+  directory = cache_directory;
+}
+
+bool IsProgramCacheEnabled() {
+  return !GetDirectory().empty() && SupportsProgramBinaries();
+}
+
+unsigned int LoadCachedProgram(const std::string& sources) {
+  const std::string path = GetEntryPath(sources);
+  if (path.empty()) {
+    return 0;
+  }
+  TraceScope trace("io", "LoadCachedProgram");
+  std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    return 0;
+  }
+  char magic[sizeof(kMagic)];
+  uint32_t format;
+  if (!file.read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + sizeof(magic), kMagic) ||
+      !file.read(reinterpret_cast<char*>(&format), sizeof(format))) {
+    return 0;
+  }
+  const std::vector<char> binary((std::istreambuf_iterator<char>(file)),
+                                 std::istreambuf_iterator<char>());
+
+  // Drivers reject binaries of other versions, or of the same version built
+  // differently, when they are loaded.
+  const GLuint program = glCreateProgram();
+  glProgramBinary(program, format, binary.data(),
+                  static_cast<GLsizei>(binary.size()));
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    // A rejected format raises GL_INVALID_ENUM, which mustn't be left for
+    // later error checks to find.
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void StoreCachedProgram(const std::string& sources, unsigned int program) {
+  const std::string path = GetEntryPath(sources);
+  if (path.empty()) {
+    return;
+  }
+  TraceScope trace("io", "StoreCachedProgram");
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+  if (length <= 0) {
+    return;
+  }
+
+  // Written under a unique name and renamed, so concurrent bakes never read a
+  // partial entry.
+  const std::string temp_path =
+      path + "." +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                     static_cast<size_t>(std::chrono::steady_clock::now()
+                                             .time_since_epoch()
+                                             .count()));
+  {
+    std::ofstream file(temp_path.c_str(),
+                       std::ios::out | std::ios::trunc | std::ios::binary);
+    const uint32_t binary_format = format;
+    file.write(kMagic, sizeof(kMagic));
+    file.write(reinterpret_cast<const char*>(&binary_format),
+               sizeof(binary_format));
+    file.write(binary.data(), length);
+    if (!file) {
+      file.close();
+      std::remove(temp_path.c_str());
+      return;
+    }
+  }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+// Persists linked programs with glGetProgramBinary, so later runs skip
+// compiling them, which takes seconds on software rasterizers. Entries are
+// keyed by a hash of the sources and the driver's vendor, renderer and version
+// strings; a binary the driver rejects is compiled again and replaced.
+
+// Empty, the default, disables the cache. The directory must exist.
+void SetProgramCacheDirectory(const std::string& directory);
+// Whether a directory is set and the current context supports program
+// binaries. Needs a current OpenGL context.
+bool IsProgramCacheEnabled();
+
+// Returns a linked program of the cached binary for |sources|, the vertex and
+// fragment source concatenated, or 0 if there is none or the driver rejects
+// it. Needs a current OpenGL context.
+unsigned int LoadCachedProgram(const std::string& sources);
+
+// Stores the binary of |program|, linked with the retrievable hint set, for
+// |sources|. Failures only skip the cache.
+void StoreCachedProgram(const std::string& sources, unsigned int program);
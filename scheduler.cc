@@ -0,0 +1,88 @@
+#include "scheduler.h"
+
+#include "gl_context.h"
+#include "trace.h"
+
+BakeScheduler::~BakeScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    changed_.notify_all();
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+int BakeScheduler::Start(int num_contexts) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_starting_ += num_contexts;
+  // Every context's baker counts against the memory budget.
+  const int num_bakers = static_cast<int>(threads_.size()) + num_contexts;
+  for (int i = 0; i < num_contexts; ++i) {
+    threads_.emplace_back([this, num_bakers]() { WorkerLoop(num_bakers); });
+  }
+  changed_.wait(lock, [this]() { return num_starting_ == 0; });
+  return num_contexts_;
+}
+
+void BakeScheduler::Submit(const BakeJob& job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  jobs_.push_back(job);
+  changed_.notify_all();
+}
+
+void BakeScheduler::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock,
+                [this]() { return jobs_.empty() && num_running_ == 0; });
+}
+
+void BakeScheduler::WorkerLoop(int num_bakers) {
+  GlContext context;
+  const bool created = CreateGlContext(true, &context);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --num_starting_;
+    if (created) {
+      ++num_contexts_;
+    }
+    changed_.notify_all();
+  }
+  if (!created) {
+    return;
+  }
+
+  {
+    // The baker keeps textures that must be released with the context.
+    Baker baker(BakeOptions(), num_bakers);
+    for (;;) {
+      BakeJob job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          break;
+        }
+        job = jobs_.front();
+        jobs_.pop_front();
+        ++num_running_;
+      }
+
+      bool ok;
+      {
+        TraceScope trace("stage", "bake " + job.input);
+        baker.set_options(job.options);
+        ok = baker.BakeFile(job.input, job.sink);
+      }
+      if (job.done) {
+        job.done(ok);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      --num_running_;
+      changed_.notify_all();
+    }
+  }
+  DestroyGlContext(&context);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "baker.h"
+
+// Spreads bakes over several headless OpenGL contexts, each current on a worker
+// thread of its own with its own shaders, BRDF lookup tables and ASTC block
+// cache. On software rasterizers like llvmpipe and on hosts with several GPUs a
+// single context serializes the GPU stages, so throughput then scales with the
+// number of contexts. Every context costs the memory of a whole bake.
+
+struct BakeJob {
+  // A .hdr or .exr file.
+  std::string input;
+  BakeOptions options;
+  // Receives the outputs on the worker thread. Must outlive the job.
+  BakeSink* sink = nullptr;
+  // Called on the worker thread once the job finished, may be empty.
+  std::function<void(bool ok)> done;
+};
+
+class BakeScheduler {
+ public:
+  BakeScheduler() {}
+  // Finishes the submitted jobs and destroys the contexts.
+  ~BakeScheduler();
+
+  BakeScheduler(const BakeScheduler&) = delete;
+  BakeScheduler& operator=(const BakeScheduler&) = delete;
+
+  // Starts |num_contexts| worker threads and creates their contexts. Returns
+  // the number of contexts that could be created; jobs can only be submitted
+  // if it is at least 1. Linux only.
+  int Start(int num_contexts);
+
+  // Jobs start in the order they are submitted, on the first idle context.
+  void Submit(const BakeJob& job);
+  // Waits until all submitted jobs finished.
+  void Wait();
+
+ private:
+  // |num_bakers| is the number of contexts started so far, which share the
+  // memory budget.
+  void WorkerLoop(int num_bakers);
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<BakeJob> jobs_;
+  std::vector<std::thread> threads_;
+  int num_starting_ = 0;
+  int num_contexts_ = 0;
+  int num_running_ = 0;
+  bool stopping_ = false;
+};
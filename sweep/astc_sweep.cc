@@ -0,0 +1,237 @@
+// Encodes a cubemap with every ASTC footprint and compression speed and reports
+// the speed / quality trade-off of each combination.
+//
+//   bazel run //sweep:astc_sweep -- --input=specular.ktx --csv=sweep.csv
+//
+// Combinations run in parallel, but every encode is single threaded so the
+// times are comparable between them. Combinations that no other combination
+// beats in encode time, bits per pixel and log-RMSE at once are marked as
+// Pareto optimal.
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "astc.h"
+#include "flags.h"
+#include "ktx.h"
+#include "parallel.h"
+#include "pixel_formats.h"
+
+// Defined by the ASTC encoder. The progress output would garble the table.
+extern int suppress_progress_counter;
+
+namespace {
+struct Face {
+  int width;
+  int height;
+  std::vector<float> rgb;
+};
+
+struct Result {
+  AstcFootprint footprint;
+  CompressionSpeed speed;
+  double encode_ms;
+  double bits_per_pixel;
+  double psnr_db;
+  double log_rmse;
+  bool pareto_optimal;
+};
+
+// Loads |mip| of every face of an uncompressed float or half float cubemap.
+bool LoadCubemap(const std::string& file, uint32_t mip,
+                 std::vector<Face>* faces) {
+  std::ifstream stream(file, std::ios::binary);
+  if (!stream) {
+    std::cerr << "Can't open " << file << std::endl;
+    return false;
+  }
+  const std::vector<char> mem((std::istreambuf_iterator<char>(stream)),
+                              std::istreambuf_iterator<char>());
+
+  for (uint32_t face = 0; face < 6; ++face) {
+    ktx::KtxHeader header;
+    const char* data;
+    uint32_t size;
+    if (!ktx::GetImageData(mem.data(), mem.size(), mip, face, &header, &data,
+                           &size) ||
+        header.number_of_faces != 6) {
+      std::cerr << file << " is not a cubemap with mip " << mip << std::endl;
+      return false;
+    }
+    const int components = header.gl_format == GL_RGBA  ? 4
+                           : header.gl_format == GL_RGB ? 3
+                                                        : 0;
+    const bool half = header.gl_type == GL_HALF_FLOAT;
+    if (!components || (!half && header.gl_type != GL_FLOAT)) {
+      std::cerr << "Only RGB and RGBA float and half float cubemaps are "
+                   "supported"
+                << std::endl;
+      return false;
+    }
+
+    Face out;
+    out.width = std::max(1u, header.pixel_width >> mip);
+    out.height = std::max(1u, header.pixel_height >> mip);
+    const size_t num_pixels = static_cast<size_t>(out.width) * out.height;
+    const size_t texel_size = components * (half ? 2 : 4);
+    if (size < num_pixels * texel_size) {
+      std::cerr << file << " is truncated" << std::endl;
+      return false;
+    }
+    out.rgb.resize(num_pixels * 3);
+    for (size_t i = 0; i < num_pixels; ++i) {
+      const char* texel = data + i * texel_size;
+      for (int c = 0; c < 3; ++c) {
+        if (half) {
+          uint16_t value;
+          memcpy(&value, texel + 2 * c, sizeof(value));
+          out.rgb[3 * i + c] = HalfToFloat(value);
+        } else {
+          memcpy(&out.rgb[3 * i + c], texel + 4 * c, sizeof(float));
+        }
+      }
+    }
+    faces->push_back(std::move(out));
+  }
+  return true;
+}
+
+Result Evaluate(const std::vector<Face>& faces, const AstcFootprint& footprint,
+                CompressionSpeed speed, float peak) {
+  Result result = {footprint, speed, 0.0, 128.0 / (footprint.x * footprint.y),
+                   0.0, 0.0, false};
+  double squared_error = 0.0;
+  double squared_log_error = 0.0;
+  size_t num_values = 0;
+  for (const Face& face : faces) {
+    uint8_t* data;
+    size_t size;
+    const auto start = std::chrono::steady_clock::now();
+    EncodeAstc(face.rgb.data(), face.width, face.height, GL_RGB, GL_FLOAT,
+               &data, &size, footprint.x, footprint.y, speed,
+               AstcProfile::kHdr, nullptr, 1);
+    const auto end = std::chrono::steady_clock::now();
+    result.encode_ms +=
+        std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::vector<float> decoded(face.width * face.height * 4);
+    DecodeAstc(data, face.width, face.height, footprint.x, footprint.y,
+               AstcProfile::kHdr, decoded.data());
+    delete[] data;
+
+    for (size_t i = 0; i < decoded.size() / 4; ++i) {
+      for (int c = 0; c < 3; ++c) {
+        const double expected = std::max(0.0f, face.rgb[3 * i + c]);
+        const double actual = std::max(0.0f, decoded[4 * i + c]);
+        squared_error += (expected - actual) * (expected - actual);
+        const double log_error =
+            std::log2(1.0 + expected) - std::log2(1.0 + actual);
+        squared_log_error += log_error * log_error;
+      }
+    }
+    num_values += decoded.size() / 4 * 3;
+  }
+
+  const double mse = squared_error / num_values;
+  result.psnr_db = mse > 0.0 ? 10.0 * std::log10(peak * peak / mse) : 999.0;
+  result.log_rmse = std::sqrt(squared_log_error / num_values);
+  return result;
+}
+
+bool Dominates(const Result& a, const Result& b) {
+  return a.encode_ms <= b.encode_ms && a.bits_per_pixel <= b.bits_per_pixel &&
+         a.log_rmse <= b.log_rmse &&
+         (a.encode_ms < b.encode_ms || a.bits_per_pixel < b.bits_per_pixel ||
+          a.log_rmse < b.log_rmse);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string input;
+  std::string csv = "astc_sweep.csv";
+  int mip = 0;
+  int jobs = GetDefaultThreadCount();
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (ParseFlag(argv[i], "input", &value)) {
+      input = value;
+    } else if (ParseFlag(argv[i], "csv", &value)) {
+      csv = value;
+    } else if (ParseFlag(argv[i], "mip", &value)) {
+      mip = std::max(0, std::stoi(value));
+    } else if (ParseFlag(argv[i], "jobs", &value)) {
+      jobs = std::max(1, std::stoi(value));
+    } else {
+      std::cerr << "Unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (input.empty()) {
+    std::cerr << "Usage: astc_sweep --input=<cubemap.ktx> [--mip=0] "
+                 "[--csv=astc_sweep.csv] [--jobs=N]"
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<Face> faces;
+  if (!LoadCubemap(input, mip, &faces)) {
+    return 1;
+  }
+  float peak = 0.0f;
+  for (const Face& face : faces) {
+    for (float value : face.rgb) {
+      peak = std::max(peak, value);
+    }
+  }
+  peak = std::max(peak, 1e-6f);
+
+  suppress_progress_counter = 1;
+  const int num_footprints =
+      sizeof(kAstcFootprints) / sizeof(kAstcFootprints[0]);
+  std::vector<Result> results(num_footprints * kNumCompressionSpeeds);
+  ParallelFor(static_cast<int>(results.size()),
+              [&](int i) {
+                results[i] = Evaluate(
+                    faces, kAstcFootprints[i / kNumCompressionSpeeds],
+                    static_cast<CompressionSpeed>(i % kNumCompressionSpeeds),
+                    peak);
+              },
+              jobs);
+
+  for (Result& result : results) {
+    result.pareto_optimal = true;
+    for (const Result& other : results) {
+      if (Dominates(other, result)) {
+        result.pareto_optimal = false;
+        break;
+      }
+    }
+  }
+
+  std::ofstream csv_file(csv);
+  csv_file << "footprint,speed,encode_ms,bpp,psnr_db,log_rmse,pareto\n";
+  printf("%-9s %-10s %12s %6s %9s %9s\n", "footprint", "speed", "encode_ms",
+         "bpp", "psnr_db", "log_rmse");
+  for (const Result& result : results) {
+    const std::string footprint = std::to_string(result.footprint.x) + "x" +
+                                  std::to_string(result.footprint.y);
+    const char* speed = CompressionSpeedToString(result.speed);
+    printf("%-9s %-10s %12.1f %6.2f %9.2f %9.4f%s\n", footprint.c_str(), speed,
+           result.encode_ms, result.bits_per_pixel, result.psnr_db,
+           result.log_rmse, result.pareto_optimal ? " *" : "");
+    csv_file << footprint << "," << speed << "," << result.encode_ms << ","
+             << result.bits_per_pixel << "," << result.psnr_db << ","
+             << result.log_rmse << "," << (result.pareto_optimal ? 1 : 0)
+             << "\n";
+  }
+  printf("* Pareto optimal in encode time, bits per pixel and log-RMSE.\n");
+  return 0;
+}
@@ -0,0 +1,188 @@
+#include "trace.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace {
+// Thread id of the GPU track.
+const int kGpuThreadId = 1000;
+
+struct Event {
+  const char* category;
+  std::string name;
+  int thread_id;
+  int64_t start_us;
+  int64_t duration_us;
+};
+
+struct PendingGpuEvent {
+  const char* category;
+  std::string name;
+  unsigned int queries[2];
+};
+
+std::atomic<bool> enabled(false);
+std::mutex mutex;
+std::vector<Event> events;
+std::vector<PendingGpuEvent> pending_gpu_events;
+std::chrono::steady_clock::time_point cpu_epoch;
+int64_t gpu_epoch_ns = 0;
+std::atomic<int> next_thread_id(0);
+
+int64_t GetTimeUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - cpu_epoch)
+      .count();
+}
+
+// Small sequential ids read better in the trace viewers than native ones. The
+// thread that starts tracing is 0.
+int GetThreadId() {
+  thread_local int thread_id = next_thread_id++;
+  return thread_id;
+}
+
+std::string JsonString(const std::string& value) {
+  std::string escaped = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+}  // namespace
+
+void StartTracing() {
+  std::lock_guard<std::mutex> lock(mutex);
+  events.clear();
+  next_thread_id = 0;
+  GetThreadId();
+  // GL_TIMESTAMP and the CPU clock are read back to back, so GPU spans can be
+  // shown on the same time axis.
+  GLint64 gpu_now = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+  cpu_epoch = std::chrono::steady_clock::now();
+  gpu_epoch_ns = gpu_now;
+  enabled = true;
+}
+
+bool IsTracingEnabled() { return enabled; }
+
+void StopTracing() {
+  enabled = false;
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const PendingGpuEvent& pending : pending_gpu_events) {
+    GLuint64 start_ns = 0;
+    GLuint64 end_ns = 0;
+    glGetQueryObjectui64v(pending.queries[0], GL_QUERY_RESULT, &start_ns);
+    glGetQueryObjectui64v(pending.queries[1], GL_QUERY_RESULT, &end_ns);
+    glDeleteQueries(2, pending.queries);
+    const int64_t start_us =
+        (static_cast<int64_t>(start_ns) - gpu_epoch_ns) / 1000;
+    events.push_back({pending.category, pending.name, kGpuThreadId, start_us,
+                      static_cast<int64_t>(end_ns - start_ns) / 1000});
+  }
+  pending_gpu_events.clear();
+}
+
+bool WriteTrace(const std::string& file) {
+  std::ofstream stream(file);
+  if (!stream) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  stream << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  stream << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"tid\": 0, \"args\": {\"name\": \"main\"}},\n";
+  stream << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"tid\": "
+         << kGpuThreadId << ", \"args\": {\"name\": \"GPU\"}}";
+  for (const Event& event : events) {
+    stream << ",\n  {\"name\": " << JsonString(event.name)
+           << ", \"cat\": " << JsonString(event.category)
+           << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread_id
+           << ", \"ts\": " << event.start_us
+           << ", \"dur\": " << event.duration_us << "}";
+  }
+  stream << "\n]}\n";
+  return static_cast<bool>(stream);
+}
+
+void PrintTraceSummary(std::ostream& out) {
+  struct Totals {
+    int count = 0;
+    int64_t cpu_us = 0;
+    int64_t gpu_us = 0;
+  };
+  std::map<std::string, Totals> totals;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Event& event : events) {
+      Totals& total = totals[event.name];
+      if (event.thread_id == kGpuThreadId) {
+        total.gpu_us += event.duration_us;
+      } else {
+        ++total.count;
+        total.cpu_us += event.duration_us;
+      }
+    }
+  }
+
+  std::vector<std::pair<std::string, Totals>> sorted(totals.begin(),
+                                                     totals.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<std::string, Totals>& a,
+               const std::pair<std::string, Totals>& b) {
+              return a.second.cpu_us > b.second.cpu_us;
+            });
+  char line[256];
+  snprintf(line, sizeof(line), "%-40s %7s %12s %12s\n", "span", "count",
+           "cpu_ms", "gpu_ms");
+  out << line;
+  for (const auto& entry : sorted) {
+    snprintf(line, sizeof(line), "%-40s %7d %12.2f %12.2f\n",
+             entry.first.c_str(), entry.second.count,
+             entry.second.cpu_us / 1000.0, entry.second.gpu_us / 1000.0);
+    out << line;
+  }
+}
+
+TraceScope::TraceScope(const char* category, const std::string& name,
+                       bool gpu)
+    : active_(enabled), category_(category), start_us_(0), queries_{0, 0} {
+  if (!active_) {
+    return;
+  }
+  name_ = name;
+  // Only the queries of the context tracing started on can be read back.
+  if (gpu && GetThreadId() == 0) {
+    glGenQueries(2, queries_);
+    glQueryCounter(queries_[0], GL_TIMESTAMP);
+  }
+  start_us_ = GetTimeUs();
+}
+
+TraceScope::~TraceScope() {
+  if (!active_) {
+    return;
+  }
+  const int64_t end_us = GetTimeUs();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (queries_[0]) {
+    glQueryCounter(queries_[1], GL_TIMESTAMP);
+    pending_gpu_events.push_back(
+        {category_, name_, {queries_[0], queries_[1]}});
+  }
+  events.push_back(
+      {category_, name_, GetThreadId(), start_us_, end_us - start_us_});
+}
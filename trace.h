@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Records how long the pipeline spends in its stages, readbacks, encoders and
+// file writes. Spans can be recorded from any thread while tracing is enabled
+// and are written as Chrome trace JSON, which chrome://tracing and
+// ui.perfetto.dev can open. When tracing is disabled a TraceScope costs a
+// single check.
+
+// Starts recording. Needs a current OpenGL context to line GPU time up with
+// CPU time.
+void StartTracing();
+bool IsTracingEnabled();
+
+// Stops recording and waits for the pending GPU queries. Needs the OpenGL
+// context that was current during tracing.
+void StopTracing();
+
+// Writes the spans recorded until StopTracing(). Returns false if |file| can't
+// be written.
+bool WriteTrace(const std::string& file);
+
+// Prints the number of spans and the total CPU and GPU time per span name,
+// longest first.
+void PrintTraceSummary(std::ostream& out);
+
+// Records the lifetime of the scope as a span named |name|. With |gpu| the
+// OpenGL commands issued in the scope are also timed with timestamp queries and
+// shown on a separate GPU track. GPU time is only recorded on the thread that
+// started tracing, other threads record CPU time only.
+class TraceScope {
+ public:
+  TraceScope(const char* category, const std::string& name, bool gpu = false);
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  bool active_;
+  const char* category_;
+  std::string name_;
+  int64_t start_us_;
+  unsigned int queries_[2];
+};
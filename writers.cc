@@ -0,0 +1,841 @@
+#include "writers.h"
+
+#include <glad/glad.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <ktx.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "bc6h.h"
+#include "etc2.h"
+#include "mapped_file.h"
+#include "memory.h"
+#include "parallel.h"
+#include "trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define WRITERS_USE_PWRITE
+#endif
+
+namespace {
+void GetKtxFormatForPixelFormat(PixelFormat format, ktx::KtxHeader* header) {
+  switch (format) {
+    case PixelFormat::kRgba16f: {
+      header->gl_type = GL_HALF_FLOAT;
+      header->gl_type_size = 2;
+      header->gl_format = GL_RGBA;
+      header->gl_internal_format = GL_RGBA16F;
+      header->gl_base_internal_format = GL_RGBA;
+    } break;
+    case PixelFormat::kR11G11B10f: {
+      header->gl_type = GL_UNSIGNED_INT_10F_11F_11F_REV;
+      header->gl_type_size = 4;
+      header->gl_format = GL_RGB;
+      header->gl_internal_format = GL_R11F_G11F_B10F;
+      header->gl_base_internal_format = GL_RGB;
+    } break;
+    case PixelFormat::kRgb9E5: {
+      header->gl_type = GL_UNSIGNED_INT_5_9_9_9_REV;
+      header->gl_type_size = 4;
+      header->gl_format = GL_RGB;
+      header->gl_internal_format = GL_RGB9_E5;
+      header->gl_base_internal_format = GL_RGB;
+    } break;
+    case PixelFormat::kRgbm:
+    case PixelFormat::kRgbd: {
+      header->gl_type = GL_UNSIGNED_BYTE;
+      header->gl_type_size = 1;
+      header->gl_format = GL_RGBA;
+      header->gl_internal_format = GL_RGBA8;
+      header->gl_base_internal_format = GL_RGBA;
+    } break;
+  }
+}
+
+GLenum GetTextureFormatForAstc(int footprint_x, int footprint_y) {
+  switch (footprint_x) {
+    case 4: {
+      switch (footprint_y) {
+        case 4: {
+          return GL_COMPRESSED_RGBA_ASTC_4x4;
+        }
+      }
+    } break;
+    case 5: {
+      switch (footprint_y) {
+        case 4: {
+          return GL_COMPRESSED_RGBA_ASTC_5x4;
+        }
+        case 5: {
+          return GL_COMPRESSED_RGBA_ASTC_5x5;
+        }
+      }
+    } break;
+    case 6: {
+      switch (footprint_y) {
+        case 5: {
+          return GL_COMPRESSED_RGBA_ASTC_6x5;
+        }
+        case 6: {
+          return GL_COMPRESSED_RGBA_ASTC_6x6;
+        }
+      }
+    } break;
+    case 8: {
+      switch (footprint_y) {
+        case 5: {
+          return GL_COMPRESSED_RGBA_ASTC_8x5;
+        }
+        case 6: {
+          return GL_COMPRESSED_RGBA_ASTC_8x6;
+        }
+        case 8: {
+          return GL_COMPRESSED_RGBA_ASTC_8x8;
+        }
+      }
+    } break;
+    case 10: {
+      switch (footprint_y) {
+        case 5: {
+          return GL_COMPRESSED_RGBA_ASTC_10x5;
+        }
+        case 6: {
+          return GL_COMPRESSED_RGBA_ASTC_10x6;
+        }
+        case 8: {
+          return GL_COMPRESSED_RGBA_ASTC_10x8;
+        }
+        case 10: {
+          return GL_COMPRESSED_RGBA_ASTC_10x10;
+        }
+      }
+    } break;
+    case 12: {
+      switch (footprint_y) {
+        case 10: {
+          return GL_COMPRESSED_RGBA_ASTC_12x10;
+        }
+        case 12: {
+          return GL_COMPRESSED_RGBA_ASTC_12x12;
+        }
+      }
+    } break;
+    default: {
+      // Invalid format?
+      assert(false);
+    }
+  }
+  return GL_COMPRESSED_RGBA_ASTC_4x4;
+}
+
+GLenum GetSrgbTextureFormatForAstc(int footprint_x, int footprint_y) {
+  // The sRGB formats follow the RGBA ones in the same order.
+  return GetTextureFormatForAstc(footprint_x, footprint_y) +
+         (GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4 - GL_COMPRESSED_RGBA_ASTC_4x4);
+}
+
+// Writes |header| followed by |metadata|.
+void WriteKtxHeader(std::ostream* out, ktx::KtxHeader header,
+                    const KtxMetadata& metadata) {
+  std::string key_value_data;
+  for (const auto& entry : metadata) {
+    ktx::AppendKeyValuePair(entry.first, entry.second, &key_value_data);
+  }
+  header.bytes_of_key_value_data = static_cast<uint32_t>(key_value_data.size());
+  out->write(reinterpret_cast<const char*>(&header), sizeof(ktx::KtxHeader));
+  out->write(key_value_data.data(), key_value_data.size());
+}
+
+// Compresses a single face of a single mip. |pixels| are tightly packed RGB
+// floats. The encoder allocates |out_data| with new[].
+typedef std::function<void(const float* pixels, int width, int height,
+                           uint8_t** out_data, size_t* out_size)>
+    FaceEncoder;
+
+void WriteCubemapToKtxCompressed(std::ostream* out, const std::string& name,
+                                 unsigned int texture, int cubemap_width,
+                                 int cubemap_height, int num_mips,
+                                 GLenum gl_internal_format,
+                                 GLenum gl_base_internal_format,
+                                 const FaceEncoder& encoder,
+                                 const KtxMetadata& metadata) {
+  TraceScope trace("write", name + ".ktx");
+  ktx::KtxHeader header;
+  header.gl_type = 0;    // Compressed texture must be 0.
+  header.gl_format = 0;  // Compressed texture must be 0.
+  header.gl_internal_format = gl_internal_format;
+  header.gl_base_internal_format = gl_base_internal_format;
+  header.pixel_width = cubemap_width;
+  header.pixel_height = cubemap_height;
+  header.pixel_depth = 0;
+  header.number_of_array_elements = 0;
+  header.number_of_faces = 6;
+  header.number_of_mipmap_levels = num_mips;
+  WriteKtxHeader(out, header, metadata);
+
+  // Faces are read back and encoded one at a time.
+  const size_t face_size = cubemap_width * cubemap_height * 3 * sizeof(float);
+  ScopedMemoryCharge pixels_charge(MemoryKind::kHost, face_size);
+  char* pixels = new char[face_size];
+  uint8_t* compressed_data;
+  size_t compressed_size;
+
+  for (int mip = 0; mip < num_mips; ++mip) {
+    bool write_size = true;
+
+    const int mip_width = std::max(1, cubemap_width >> mip);
+    const int mip_height = std::max(1, cubemap_height >> mip);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    for (int i = 0; i < 6; ++i) {
+      {
+        TraceScope readback_trace("readback", "glGetTexImage");
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB,
+                      GL_FLOAT, static_cast<void*>(pixels));
+      }
+      {
+        TraceScope encode_trace("encode", "encode " + name);
+        encoder(reinterpret_cast<const float*>(pixels), mip_width, mip_height,
+                &compressed_data, &compressed_size);
+      }
+
+      if (!compressed_data) {
+        assert(false);
+      }
+
+      if (write_size) {
+        const uint32_t face_size = static_cast<uint32_t>(compressed_size);
+        out->write(reinterpret_cast<const char*>(&face_size),
+                   sizeof(uint32_t));
+        write_size = false;
+      }
+      {
+        TraceScope file_trace("io", "file write");
+        out->write(reinterpret_cast<const char*>(compressed_data),
+                   compressed_size);
+      }
+      delete[] compressed_data;
+    }
+  }
+
+  delete[] pixels;
+}
+
+void WriteCubemapToKtxAsASTC(
+    std::ostream* out, const std::string& name, unsigned int texture,
+    int cubemap_width, int cubemap_height, int num_mips = 1,
+    int footprint_x = 4, int footprint_y = 4,
+    const AstcQualityPolicy& policy = AstcQualityPolicy(),
+    AstcBlockCache* cache = nullptr,
+    const KtxMetadata& metadata = KtxMetadata()) {
+  WriteCubemapToKtxCompressed(
+      out, name, texture, cubemap_width, cubemap_height, num_mips,
+      GetTextureFormatForAstc(footprint_x, footprint_y), GL_RGB,
+      [footprint_x, footprint_y, &policy, cache](
+          const float* pixels, int width, int height, uint8_t** out_data,
+          size_t* out_size) {
+        EncodeAstcWithQualityPolicy(pixels, width, height, GL_RGB, GL_FLOAT,
+                                    out_data, out_size, footprint_x,
+                                    footprint_y, policy, AstcProfile::kHdr,
+                                    cache);
+      },
+      metadata);
+}
+
+void WriteCubemapToKtxAsBC6H(
+    std::ostream* out, const std::string& name, unsigned int texture,
+    int cubemap_width, int cubemap_height, int num_mips = 1,
+    CompressionSpeed compression_speed = CompressionSpeed::kExhaustive,
+    const KtxMetadata& metadata = KtxMetadata()) {
+  WriteCubemapToKtxCompressed(
+      out, name, texture, cubemap_width, cubemap_height, num_mips,
+      GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, GL_RGB,
+      [compression_speed](const float* pixels, int width, int height,
+                          uint8_t** out_data, size_t* out_size) {
+        EncodeBc6h(pixels, width, height, GL_RGB, GL_FLOAT, out_data,
+                   out_size, compression_speed);
+      },
+      metadata);
+}
+
+// Converts |num_pixels| RGB floats to RGBM with 8 bits per channel. The caller
+// owns the returned buffer.
+uint8_t* ConvertToRgbm8(const float* pixels, int num_pixels, bool srgb) {
+  uint8_t* rgbm = new uint8_t[num_pixels * 4];
+  for (int i = 0; i < num_pixels; ++i) {
+    EncodeRgbm(pixels + 3 * i, rgbm + 4 * i, srgb);
+  }
+  return rgbm;
+}
+
+// Low-end targets without HDR ASTC or BC6H get RGBM encoded LDR blocks. With
+// |srgb| the RGB channels are sRGB encoded and the texture must be sampled as
+// sRGB before the RGBM decode.
+void WriteCubemapToKtxAsLdrASTC(
+    std::ostream* out, const std::string& name, unsigned int texture,
+    int cubemap_width, int cubemap_height, int num_mips = 1,
+    int footprint_x = 4, int footprint_y = 4, bool srgb = false,
+    const AstcQualityPolicy& policy = AstcQualityPolicy(),
+    AstcBlockCache* cache = nullptr,
+    const KtxMetadata& metadata = KtxMetadata()) {
+  const GLenum gl_internal_format =
+      srgb ? GetSrgbTextureFormatForAstc(footprint_x, footprint_y)
+           : GetTextureFormatForAstc(footprint_x, footprint_y);
+  WriteCubemapToKtxCompressed(
+      out, name, texture, cubemap_width, cubemap_height, num_mips,
+      gl_internal_format, GL_RGBA,
+      [footprint_x, footprint_y, srgb, &policy, cache](
+          const float* pixels, int width, int height, uint8_t** out_data,
+          size_t* out_size) {
+        uint8_t* rgbm = ConvertToRgbm8(pixels, width * height, srgb);
+        EncodeAstcWithQualityPolicy(
+            rgbm, width, height, GL_RGBA, GL_UNSIGNED_BYTE, out_data, out_size,
+            footprint_x, footprint_y, policy,
+            srgb ? AstcProfile::kLdrSrgb : AstcProfile::kLdr, cache);
+        delete[] rgbm;
+      },
+      metadata);
+}
+
+void WriteCubemapToKtxAsETC2(
+    std::ostream* out, const std::string& name, unsigned int texture,
+    int cubemap_width, int cubemap_height, int num_mips = 1,
+    CompressionSpeed compression_speed = CompressionSpeed::kExhaustive,
+    const KtxMetadata& metadata = KtxMetadata()) {
+  WriteCubemapToKtxCompressed(
+      out, name, texture, cubemap_width, cubemap_height, num_mips,
+      GL_COMPRESSED_RGBA8_ETC2_EAC, GL_RGBA,
+      [compression_speed](const float* pixels, int width, int height,
+                          uint8_t** out_data, size_t* out_size) {
+        uint8_t* rgbm = ConvertToRgbm8(pixels, width * height, false);
+        EncodeEtc2Rgba(rgbm, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                       out_data, out_size, compression_speed);
+        delete[] rgbm;
+      },
+      metadata);
+}
+
+bool OpenKtxFile(const std::string& file, std::ofstream* fstream) {
+  fstream->open((file + ".ktx").c_str(),
+                std::ios::out | std::ios::trunc | std::ios::binary);
+  return fstream->is_open();
+}
+
+void WriteBrdfKtxHeader(std::ostream* out, int width, int height,
+                        const KtxMetadata& metadata, GLenum format = GL_RG,
+                        GLenum internal_format = GL_RG16F) {
+  ktx::KtxHeader header;
+  header.gl_type = GL_HALF_FLOAT;
+  header.gl_format = format;
+  header.gl_internal_format = internal_format;
+  header.gl_base_internal_format = format;
+  header.pixel_width = width;
+  header.pixel_height = height;
+  header.pixel_depth = 0;
+  header.number_of_array_elements = 0;
+  header.number_of_faces = 1;
+  header.number_of_mipmap_levels = 1;
+  WriteKtxHeader(out, header, metadata);
+}
+
+// Writes a cubemap, or a 2D texture if |num_faces| is 1.
+void WriteTextureToKtx(std::ostream* out, const std::string& name,
+                       unsigned int texture, int num_faces, int width,
+                       int height, int num_mips, PixelFormat format,
+                       const KtxMetadata& metadata) {
+  TraceScope trace("write", name + ".ktx");
+  ktx::KtxHeader header;
+  GetKtxFormatForPixelFormat(format, &header);
+  header.pixel_width = width;
+  header.pixel_height = height;
+  header.pixel_depth = 0;
+  header.number_of_array_elements = 0;
+  header.number_of_faces = num_faces;
+  header.number_of_mipmap_levels = num_mips;
+  WriteKtxHeader(out, header, metadata);
+
+  const int bytes_per_pixel = GetBytesPerPixel(format);
+  const size_t face_size = width * height * bytes_per_pixel;
+  const size_t float_face_size =
+      format != PixelFormat::kRgba16f
+          ? width * height * 3 * sizeof(float)
+          : 0;
+  // Whole mips are written at once unless that doesn't fit the memory budget,
+  // in which case faces are streamed one at a time.
+  const int faces_per_write =
+      FitsMemoryBudget(face_size * num_faces + float_face_size) ? num_faces
+                                                                : 1;
+  ScopedMemoryCharge pixels_charge(
+      MemoryKind::kHost, face_size * faces_per_write + float_face_size);
+  char* pixels = new char[face_size * faces_per_write];
+  // Formats other than RGBA16F are packed on the CPU from a float read back.
+  float* float_pixels = nullptr;
+  if (float_face_size) {
+    float_pixels = new float[width * height * 3];
+  }
+  for (int mip = 0; mip < num_mips; ++mip) {
+    // Image size of a single face of this mip.
+    const int mip_width = std::max(1, width >> mip);
+    const int mip_height = std::max(1, height >> mip);
+    uint32_t image_size = mip_width * mip_height * bytes_per_pixel;
+    out->write(reinterpret_cast<const char*>(&image_size), sizeof(uint32_t));
+
+    const GLenum target =
+        num_faces == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    glBindTexture(target, texture);
+    for (int i = 0; i < num_faces; ++i) {
+      const GLenum face_target =
+          num_faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : GL_TEXTURE_2D;
+      size_t offset = image_size * (i % faces_per_write);
+      {
+        TraceScope readback_trace("readback", "glGetTexImage");
+        if (float_pixels) {
+          glGetTexImage(face_target, mip, GL_RGB, GL_FLOAT,
+                        static_cast<void*>(float_pixels));
+          ConvertRgbFloatPixels(float_pixels, mip_width * mip_height, format,
+                                pixels + offset);
+        } else {
+          glGetTexImage(face_target, mip, GL_RGBA, GL_HALF_FLOAT,
+                        static_cast<void*>(pixels + offset));
+        }
+      }
+
+      if ((i + 1) % faces_per_write == 0) {
+        TraceScope file_trace("io", "file write");
+        out->write(pixels, image_size * faces_per_write);
+      }
+    }
+  }
+
+  delete[] float_pixels;
+  delete[] pixels;
+}
+
+void WriteHalfPixels(std::ostream* out, const float* pixels, size_t count) {
+  ScopedMemoryCharge halves_charge(MemoryKind::kHost,
+                                   count * sizeof(uint16_t));
+  std::vector<uint16_t> halves(count);
+  for (size_t i = 0; i < count; ++i) {
+    halves[i] = FloatToHalf(pixels[i]);
+  }
+  const uint32_t image_size = halves.size() * sizeof(uint16_t);
+  out->write(reinterpret_cast<const char*>(&image_size), sizeof(uint32_t));
+  out->write(reinterpret_cast<const char*>(halves.data()), image_size);
+}
+
+// Reads back each face of |mip| clamped to [0, 1] as RGB bytes and passes it
+// to |face_fn| with the face index.
+void ReadCubemapBytes(
+    unsigned int texture, int cubemap_width, int cubemap_height, int mip,
+    const std::function<void(int, const unsigned char*)>& face_fn) {
+  ScopedMemoryCharge pixels_charge(
+      MemoryKind::kHost,
+      cubemap_width * cubemap_height * 3 * (sizeof(float) + 1));
+  float* pixels = new float[cubemap_width * cubemap_height * 3];
+  unsigned char* pixels_bytes =
+      new unsigned char[cubemap_width * cubemap_height * 3];
+  glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+  for (int i = 0; i < 6; ++i) {
+    {
+      TraceScope readback_trace("readback", "glGetTexImage");
+      glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB, GL_FLOAT,
+                    static_cast<void*>(pixels));
+    }
+
+    for (int i = 0; i < (cubemap_width * cubemap_height * 3); ++i) {
+      float color = std::min(1.0f, std::max(0.0f, pixels[i]));
+      // float color = pixels[i];
+      pixels_bytes[i] = static_cast<unsigned char>(color * 255.0f);
+    }
+
+    face_fn(i, pixels_bytes);
+  };
+  delete[] pixels;
+  delete[] pixels_bytes;
+}
+
+// A run of bytes at |offset| of an output file.
+struct KtxChunk {
+  const char* data;
+  size_t size;
+  uint64_t offset;
+};
+
+#ifdef WRITERS_USE_PWRITE
+bool WriteAt(int fd, const char* data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    const ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+#endif
+
+// Writes |file| of |size| bytes from |shared| and the chunks of each of
+// |elements|. Bytes not covered by any chunk are zero. Where positioned
+// writes are supported the file is allocated up front and the elements are
+// written from up to |thread_count| threads.
+bool WriteKtxChunks(const std::string& file, uint64_t size,
+                    const std::vector<KtxChunk>& shared,
+                    const std::vector<std::vector<KtxChunk>>& elements,
+                    int thread_count) {
+#ifdef WRITERS_USE_PWRITE
+  const int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = ftruncate(fd, static_cast<off_t>(size)) == 0;
+  for (const KtxChunk& chunk : shared) {
+    ok = ok && WriteAt(fd, chunk.data, chunk.size, chunk.offset);
+  }
+  std::atomic<bool> elements_ok(ok);
+  if (ok) {
+    ParallelFor(static_cast<int>(elements.size()),
+                [&](int i) {
+                  for (const KtxChunk& chunk : elements[i]) {
+                    if (!WriteAt(fd, chunk.data, chunk.size, chunk.offset)) {
+                      elements_ok = false;
+                      return;
+                    }
+                  }
+                },
+                thread_count);
+  }
+  return close(fd) == 0 && elements_ok;
+#else
+  std::vector<KtxChunk> chunks = shared;
+  for (const auto& element : elements) {
+    chunks.insert(chunks.end(), element.begin(), element.end());
+  }
+  std::sort(chunks.begin(), chunks.end(),
+            [](const KtxChunk& a, const KtxChunk& b) {
+              return a.offset < b.offset;
+            });
+  std::ofstream out(file.c_str(),
+                    std::ios::out | std::ios::trunc | std::ios::binary);
+  uint64_t position = 0;
+  for (const KtxChunk& chunk : chunks) {
+    for (; position < chunk.offset; ++position) {
+      out.put(0);
+    }
+    out.write(chunk.data, chunk.size);
+    position += chunk.size;
+  }
+  for (; position < size; ++position) {
+    out.put(0);
+  }
+  return static_cast<bool>(out);
+#endif
+}
+}  // namespace
+
+void WriteCubemapToFile(std::string file, unsigned int texture,
+                        int cubemap_width, int cubemap_height, int mip) {
+  TraceScope trace("write", file + " png");
+  // int stbi_write_hdr(char const* filename, int w, int h, int comp,
+  //                   const float* data);
+  // int stbi_write_png(char const* filename, int w, int h, int comp,
+  //                   const void* data, int stride_in_bytes);
+
+  std::string filenames[] = {
+      file + "_right",  file + "_left",  file + "_top",
+      file + "_bottom", file + "_front", file + "_back",
+  };
+  std::string extension = ".png";
+
+  ReadCubemapBytes(texture, cubemap_width, cubemap_height, mip,
+                   [&](int face, const unsigned char* pixels_bytes) {
+                     TraceScope file_trace("io", "stbi_write_png");
+                     stbi_write_png((filenames[face] + extension).c_str(),
+                                    cubemap_width, cubemap_height, 3,
+                                    pixels_bytes, 0);
+                   });
+}
+
+void EncodeCubemapToPng(unsigned int texture, int cubemap_width,
+                        int cubemap_height, int mip,
+                        std::vector<std::string>* faces) {
+  faces->assign(6, std::string());
+  ReadCubemapBytes(
+      texture, cubemap_width, cubemap_height, mip,
+      [&](int face, const unsigned char* pixels_bytes) {
+        stbi_write_png_to_func(
+            [](void* context, void* data, int size) {
+              static_cast<std::string*>(context)->append(
+                  static_cast<const char*>(data), size);
+            },
+            &(*faces)[face], cubemap_width, cubemap_height, 3, pixels_bytes,
+            0);
+      });
+}
+
+void WriteCubemapToKtx(std::string file, unsigned int texture,
+                       int cubemap_width, int cubemap_height, int num_mips,
+                       PixelFormat format) {
+  std::ofstream fstream;
+  if (OpenKtxFile(file, &fstream)) {
+    WriteCubemapToKtx(&fstream, file, texture, cubemap_width, cubemap_height,
+                      num_mips, format);
+  }
+}
+
+void WriteCubemapToKtx(std::ostream* out, const std::string& name,
+                       unsigned int texture, int cubemap_width,
+                       int cubemap_height, int num_mips, PixelFormat format,
+                       const KtxMetadata& metadata) {
+  WriteTextureToKtx(out, name, texture, 6, cubemap_width, cubemap_height,
+                    num_mips, format, metadata);
+}
+
+void WriteOctahedralToKtx(std::ostream* out, const std::string& name,
+                          unsigned int texture, int size, int num_mips,
+                          PixelFormat format, const KtxMetadata& metadata) {
+  WriteTextureToKtx(out, name, texture, 1, size, size, num_mips, format,
+                    metadata);
+}
+
+bool WriteKtxArray(const std::string& file,
+                   const std::vector<std::string>& files,
+                   const KtxMetadata& metadata, int thread_count) {
+  TraceScope trace("write", "ktx array");
+  if (files.empty()) {
+    return false;
+  }
+  std::vector<MappedFile> mapped(files.size());
+  ktx::KtxHeader header;
+  for (size_t i = 0; i < files.size(); ++i) {
+    const char* data;
+    uint32_t size;
+    ktx::KtxHeader file_header;
+    if (!mapped[i].Open(files[i].c_str()) ||
+        !ktx::GetImageData(reinterpret_cast<const char*>(mapped[i].data()),
+                           mapped[i].size(), 0, 0, &file_header, &data,
+                           &size)) {
+      std::cout << "Failed to read " << files[i] << std::endl;
+      return false;
+    }
+    if ((file_header.number_of_faces != 1 &&
+         file_header.number_of_faces != 6) ||
+        file_header.number_of_array_elements != 0 ||
+        file_header.pixel_depth != 0) {
+      std::cout << files[i] << " isn't a 2D texture or cubemap" << std::endl;
+      return false;
+    }
+    if (i == 0) {
+      header = file_header;
+    } else if (file_header.gl_internal_format != header.gl_internal_format ||
+               file_header.number_of_faces != header.number_of_faces ||
+               file_header.pixel_width != header.pixel_width ||
+               file_header.pixel_height != header.pixel_height ||
+               file_header.number_of_mipmap_levels !=
+                   header.number_of_mipmap_levels) {
+      std::cout << files[i] << " doesn't match " << files[0] << std::endl;
+      return false;
+    }
+  }
+  header.number_of_array_elements = static_cast<uint32_t>(files.size());
+  std::ostringstream header_stream;
+  WriteKtxHeader(&header_stream, header, metadata);
+
+  // Lays out the file before writing any of it. The image size of an array
+  // level covers all elements and faces, which follow each other without the
+  // padding of non-array cubemaps.
+  std::vector<KtxChunk> shared;
+  std::vector<std::vector<KtxChunk>> elements(files.size());
+  const std::string header_data = header_stream.str();
+  shared.push_back({header_data.data(), header_data.size(), 0});
+  uint64_t offset = header_data.size();
+  const uint32_t num_mips = std::max(1u, header.number_of_mipmap_levels);
+  std::vector<uint32_t> image_sizes(num_mips);
+  for (uint32_t mip = 0; mip < num_mips; ++mip) {
+    shared.push_back({reinterpret_cast<const char*>(&image_sizes[mip]),
+                      sizeof(uint32_t), offset});
+    offset += sizeof(uint32_t);
+    uint32_t face_size = 0;
+    uint64_t level_size = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+      for (uint32_t face = 0; face < header.number_of_faces; ++face) {
+        KtxChunk chunk;
+        uint32_t size;
+        ktx::KtxHeader file_header;
+        if (!ktx::GetImageData(reinterpret_cast<const char*>(mapped[i].data()),
+                               mapped[i].size(), mip, face, &file_header,
+                               &chunk.data, &size) ||
+            (face_size != 0 && size != face_size)) {
+          std::cout << "Failed to read level " << mip << " of " << files[i]
+                    << std::endl;
+          return false;
+        }
+        face_size = size;
+        chunk.size = size;
+        chunk.offset = offset;
+        elements[i].push_back(chunk);
+        level_size += size;
+        offset += size;
+      }
+    }
+    // KTX 1 stores the size of a level in 32 bits.
+    if (level_size > UINT32_MAX) {
+      std::cout << "Level " << mip << " of " << files.size()
+                << " elements exceeds the 4 GiB a KTX level can hold"
+                << std::endl;
+      return false;
+    }
+    image_sizes[mip] = static_cast<uint32_t>(level_size);
+    offset += 3 - (level_size + 3) % 4;
+  }
+  return WriteKtxChunks(file, offset, shared, elements, thread_count);
+}
+
+bool CompressedFormatFromString(const std::string& name,
+                                CompressedFormat* format) {
+  if (name == "astc") {
+    *format = CompressedFormat::kAstc;
+  } else if (name == "bc6h") {
+    *format = CompressedFormat::kBc6h;
+  } else if (name == "astc_ldr") {
+    *format = CompressedFormat::kAstcLdr;
+  } else if (name == "astc_srgb") {
+    *format = CompressedFormat::kAstcSrgb;
+  } else if (name == "etc2") {
+    *format = CompressedFormat::kEtc2;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* CompressedFormatToString(CompressedFormat format) {
+  switch (format) {
+    case CompressedFormat::kAstc:
+      return "astc";
+    case CompressedFormat::kBc6h:
+      return "bc6h";
+    case CompressedFormat::kAstcLdr:
+      return "astc_ldr";
+    case CompressedFormat::kAstcSrgb:
+      return "astc_srgb";
+    case CompressedFormat::kEtc2:
+      return "etc2";
+  }
+  return "";
+}
+
+void WriteCubemapToKtxCompressedAs(CompressedFormat format, std::string file,
+                                   unsigned int texture, int cubemap_width,
+                                   int cubemap_height, int num_mips,
+                                   const AstcQualityPolicy& astc_policy,
+                                   AstcBlockCache* astc_cache) {
+  file += std::string("_") + CompressedFormatToString(format);
+  std::ofstream fstream;
+  if (OpenKtxFile(file, &fstream)) {
+    WriteCubemapToKtxCompressedAs(format, &fstream, file, texture,
+                                  cubemap_width, cubemap_height, num_mips,
+                                  astc_policy, astc_cache);
+  }
+}
+
+void WriteCubemapToKtxCompressedAs(
+    CompressedFormat format, std::ostream* out, const std::string& name,
+    unsigned int texture, int cubemap_width, int cubemap_height, int num_mips,
+    const AstcQualityPolicy& astc_policy, AstcBlockCache* astc_cache,
+    const KtxMetadata& metadata) {
+  switch (format) {
+    case CompressedFormat::kAstc:
+      WriteCubemapToKtxAsASTC(out, name, texture, cubemap_width,
+                              cubemap_height, num_mips, 4, 4, astc_policy,
+                              astc_cache, metadata);
+      break;
+    case CompressedFormat::kBc6h:
+      WriteCubemapToKtxAsBC6H(out, name, texture, cubemap_width,
+                              cubemap_height, num_mips,
+                              CompressionSpeed::kExhaustive, metadata);
+      break;
+    case CompressedFormat::kAstcLdr:
+      WriteCubemapToKtxAsLdrASTC(out, name, texture, cubemap_width,
+                                 cubemap_height, num_mips, 4, 4, false,
+                                 astc_policy, astc_cache, metadata);
+      break;
+    case CompressedFormat::kAstcSrgb:
+      WriteCubemapToKtxAsLdrASTC(out, name, texture, cubemap_width,
+                                 cubemap_height, num_mips, 4, 4, true,
+                                 astc_policy, astc_cache, metadata);
+      break;
+    case CompressedFormat::kEtc2:
+      WriteCubemapToKtxAsETC2(out, name, texture, cubemap_width,
+                              cubemap_height, num_mips,
+                              CompressionSpeed::kExhaustive, metadata);
+      break;
+  }
+}
+
+void WriteBrdfToKtx(std::string file, unsigned int texture, int width,
+                    int height) {
+  std::ofstream fstream;
+  if (!OpenKtxFile(file, &fstream)) {
+    return;
+  }
+  WriteBrdfToKtx(&fstream, texture, width, height);
+  fstream.close();
+  WriteBrdfToPng(file, texture, width, height);
+}
+
+void WriteBrdfToKtx(std::ostream* out, unsigned int texture, int width,
+                    int height, const KtxMetadata& metadata) {
+  TraceScope trace("write", "brdf.ktx");
+  WriteBrdfKtxHeader(out, width, height, metadata);
+
+  uint32_t image_size = width * height * 2 * sizeof(float) / 2;
+  ScopedMemoryCharge pixels_charge(MemoryKind::kHost, image_size);
+  char* pixels = new char[image_size];
+  out->write(reinterpret_cast<const char*>(&image_size), sizeof(uint32_t));
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  {
+    TraceScope readback_trace("readback", "glGetTexImage");
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_HALF_FLOAT,
+                  static_cast<void*>(pixels));
+  }
+
+  out->write(pixels, image_size);
+  delete[] pixels;
+}
+
+void WriteBrdfToKtx(std::ostream* out, const float* pixels, int width,
+                    int height, const KtxMetadata& metadata) {
+  TraceScope trace("write", "brdf.ktx");
+  WriteBrdfKtxHeader(out, width, height, metadata);
+  WriteHalfPixels(out, pixels, width * height * 2);
+}
+
+void WriteBrdfPackToKtx(std::ostream* out, const float* pixels, int width,
+                        int height, const KtxMetadata& metadata) {
+  TraceScope trace("write", "brdf_pack.ktx");
+  WriteBrdfKtxHeader(out, width, height, metadata, GL_RGBA, GL_RGBA16F);
+  WriteHalfPixels(out, pixels, width * height * 4);
+}
+
+void WriteBrdfToPng(std::string file, unsigned int texture, int width,
+                    int height) {
+  char* pixels = new char[width * height * 3];
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                static_cast<void*>(pixels));
+  stbi_write_png((file + ".png").c_str(), width, height, 3, pixels, 0);
+  delete[] pixels;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "astc.h"
+#include "pixel_formats.h"
+
+// Writers for the pipeline outputs. |texture| is a GL texture name read back
+// from the current context and |file| is the path without extension. The KTX
+// writers also come in variants writing to a stream, where |name| only labels
+// the trace spans.
+
+// Key/value pairs stored in the header of the stream variants of the KTX
+// writers, e.g. the settings a bake used.
+typedef std::vector<std::pair<std::string, std::string>> KtxMetadata;
+
+// Writes each face of |mip| clamped to [0, 1] as |file|_<face>.png.
+void WriteCubemapToFile(std::string file, unsigned int texture,
+                        int cubemap_width, int cubemap_height, int mip = 0);
+// Encodes the PNGs of WriteCubemapToFile() into |faces| instead, e.g. to time
+// them.
+void EncodeCubemapToPng(unsigned int texture, int cubemap_width,
+                        int cubemap_height, int mip,
+                        std::vector<std::string>* faces);
+
+void WriteCubemapToKtx(std::string file, unsigned int texture,
+                       int cubemap_width, int cubemap_height, int num_mips = 1,
+                       PixelFormat format = PixelFormat::kRgba16f);
+void WriteCubemapToKtx(std::ostream* out, const std::string& name,
+                       unsigned int texture, int cubemap_width,
+                       int cubemap_height, int num_mips = 1,
+                       PixelFormat format = PixelFormat::kRgba16f,
+                       const KtxMetadata& metadata = KtxMetadata());
+// Writes the 2D mip chain of GenerateOctahedralMap().
+void WriteOctahedralToKtx(std::ostream* out, const std::string& name,
+                          unsigned int texture, int size, int num_mips,
+                          PixelFormat format = PixelFormat::kRgba16f,
+                          const KtxMetadata& metadata = KtxMetadata());
+// Packs the KTX |files|, e.g. the prefilter maps of several probes, into the
+// array KTX |file| with an element per file, in order. 2D textures become a 2D
+// array and cubemaps a cubemap array. The file is laid out up front and the
+// elements are written from up to |thread_count| threads, 0 using
+// GetDefaultThreadCount(). Returns false if a file can't be read or they
+// differ in format, size, faces or number of mips.
+bool WriteKtxArray(const std::string& file,
+                   const std::vector<std::string>& files,
+                   const KtxMetadata& metadata = KtxMetadata(),
+                   int thread_count = 0);
+
+enum class CompressedFormat {
+  kAstc = 0,
+  kBc6h,
+  kAstcLdr,
+  kAstcSrgb,
+  kEtc2,
+};
+
+bool CompressedFormatFromString(const std::string& name,
+                                CompressedFormat* format);
+const char* CompressedFormatToString(CompressedFormat format);
+
+// Writes |file| with the format name appended, e.g. |file|_astc.ktx.
+void WriteCubemapToKtxCompressedAs(CompressedFormat format, std::string file,
+                                   unsigned int texture, int cubemap_width,
+                                   int cubemap_height, int num_mips,
+                                   const AstcQualityPolicy& astc_policy,
+                                   AstcBlockCache* astc_cache);
+void WriteCubemapToKtxCompressedAs(
+    CompressedFormat format, std::ostream* out, const std::string& name,
+    unsigned int texture, int cubemap_width, int cubemap_height, int num_mips,
+    const AstcQualityPolicy& astc_policy, AstcBlockCache* astc_cache,
+    const KtxMetadata& metadata = KtxMetadata());
+
+// Writes the RG16F lookup table as |file|.ktx and a preview as |file|.png.
+void WriteBrdfToKtx(std::string file, unsigned int texture, int width,
+                    int height);
+void WriteBrdfToKtx(std::ostream* out, unsigned int texture, int width,
+                    int height, const KtxMetadata& metadata = KtxMetadata());
+// Writes the lookup table from tightly packed RG floats, e.g. of
+// IntegrateBrdfLookUpTable(), without a GL context.
+void WriteBrdfToKtx(std::ostream* out, const float* pixels, int width,
+                    int height, const KtxMetadata& metadata = KtxMetadata());
+// Writes the RGBA16F table of IntegrateBrdfLutPack().
+void WriteBrdfPackToKtx(std::ostream* out, const float* pixels, int width,
+                        int height,
+                        const KtxMetadata& metadata = KtxMetadata());
+void WriteBrdfToPng(std::string file, unsigned int texture, int width,
+                    int height);